@@ -0,0 +1,375 @@
+/*
+ * KaiOS - Host Heap Benchmark
+ * Replays reproducible allocation traces against the kernel heap on Linux
+ *
+ * Usage: heap_bench [trace] [-n ops] [-s seed] [-l limit_kb]
+ *   trace     random, fs, gui or all (default)
+ *   -n ops    operations per trace (default 1000000)
+ *   -s seed   PRNG seed (default 1), identical seeds replay identical traces
+ *   -l kb     cap the memory the PMM shim hands out (default unlimited)
+ *
+ * Every kmalloc/krealloc/kfree is timed individually. Latencies include
+ * host effects (first-touch page faults when the heap grows), so compare
+ * runs on the same machine. Note that pointers are 64-bit on the host, so
+ * block headers are larger than on the i686 target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "bench/heap_bench.h"
+
+#define MAX_LIVE         4096
+#define LATENCY_BUCKETS  40     // log2(ns) histogram for percentiles
+#define TIMELINE_SAMPLES 8
+
+// ============================================================================
+// Reproducible randomness and timing
+// ============================================================================
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    // xorshift32
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+// Log-uniform size in [lo, hi]: small sizes dominate, as in real workloads
+static uint32_t rng_log_size(uint32_t lo, uint32_t hi) {
+    uint32_t bits_lo = 31 - __builtin_clz(lo);
+    uint32_t bits_hi = 31 - __builtin_clz(hi);
+    uint32_t bits = rng_range(bits_lo, bits_hi);
+    uint32_t size = (1U << bits) + rng() % (1U << bits);
+    return size < lo ? lo : (size > hi ? hi : size);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ============================================================================
+// Measurement
+// ============================================================================
+
+typedef struct {
+    uint64_t ops;
+    uint64_t total_ns;
+    uint64_t worst_ns;
+    uint64_t failures;
+    uint64_t latency[LATENCY_BUCKETS];
+} bench_result_t;
+
+typedef struct {
+    void* ptr;
+    uint32_t size;
+} live_block_t;
+
+static bench_result_t result;
+static live_block_t live[MAX_LIVE];
+static uint32_t live_count = 0;
+
+static uint64_t timeline_every = 0;
+static uint64_t next_sample = 0;
+
+static void record(uint64_t ns) {
+    result.ops++;
+    result.total_ns += ns;
+    if (ns > result.worst_ns) {
+        result.worst_ns = ns;
+    }
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    result.latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+}
+
+// Upper bound (ns) under which the given fraction of operations finished
+static uint64_t percentile(double fraction) {
+    uint64_t target = (uint64_t)(result.ops * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += result.latency[i];
+        if (seen >= target) {
+            return 1ULL << i;
+        }
+    }
+    return result.worst_ns;
+}
+
+static void sample_timeline(void) {
+    if (result.ops < next_sample) {
+        return;
+    }
+    next_sample += timeline_every;
+
+    bench_heap_stats_t stats;
+    bench_heap_stats(&stats);
+    printf("  %10llu %9u %9u %11u %11u %6u%%\n",
+           (unsigned long long)result.ops, stats.used / 1024, stats.heap_size / 1024,
+           stats.free_blocks, stats.largest_free / 1024, stats.fragmentation);
+}
+
+// Timed heap operations. Blocks are filled so that the allocator's
+// metadata lives next to dirty cache lines, as it would in the kernel.
+static void* timed_alloc(uint32_t size) {
+    uint64_t start = now_ns();
+    void* ptr = bench_kmalloc(size);
+    record(now_ns() - start);
+
+    if (ptr == NULL) {
+        result.failures++;
+    } else {
+        memset(ptr, (int)size, size < 64 ? size : 64);
+    }
+    sample_timeline();
+    return ptr;
+}
+
+static void* timed_realloc(void* ptr, uint32_t size) {
+    uint64_t start = now_ns();
+    void* new_ptr = bench_krealloc(ptr, size);
+    record(now_ns() - start);
+
+    if (new_ptr == NULL) {
+        result.failures++;
+    }
+    sample_timeline();
+    return new_ptr;
+}
+
+static void timed_free(void* ptr) {
+    uint64_t start = now_ns();
+    bench_kfree(ptr);
+    record(now_ns() - start);
+    sample_timeline();
+}
+
+// Live block table helpers
+static void live_add(void* ptr, uint32_t size) {
+    if (ptr != NULL && live_count < MAX_LIVE) {
+        live[live_count].ptr = ptr;
+        live[live_count].size = size;
+        live_count++;
+    } else if (ptr != NULL) {
+        timed_free(ptr);
+    }
+}
+
+static void live_free(uint32_t index) {
+    timed_free(live[index].ptr);
+    live[index] = live[--live_count];
+}
+
+static void live_free_all(void) {
+    while (live_count > 0) {
+        live_free(live_count - 1);
+    }
+}
+
+// ============================================================================
+// Traces
+// ============================================================================
+
+// Independent random sizes, mostly small, with a steady-state live set
+static void trace_random(uint64_t ops) {
+    const uint32_t target_live = 2000;
+
+    while (result.ops < ops) {
+        if (live_count == 0 || (live_count < target_live && (rng() & 1))) {
+            uint32_t pick = rng() % 100;
+            uint32_t size;
+            if (pick < 75) {
+                size = rng_range(8, 256);
+            } else if (pick < 95) {
+                size = rng_range(256, 4096);
+            } else {
+                size = rng_range(4096, 65536);
+            }
+            live_add(timed_alloc(size), size);
+        } else {
+            live_free(rng() % live_count);
+        }
+    }
+    live_free_all();
+}
+
+// File system: files created, appended to, overwritten and deleted, with a
+// periodic save/load pass that allocates temporary tables and sector
+// buffers (the pattern fs_save/fs_load produce)
+static void trace_fs(uint64_t ops) {
+    const uint32_t max_files = 256;
+    const uint32_t entry_size = 80;
+
+    while (result.ops < ops) {
+        uint32_t pick = rng() % 100;
+
+        if (live_count == 0 || (pick < 20 && live_count < max_files)) {
+            // Create (fs_create + fs_write)
+            uint32_t size = rng_log_size(16, 16384);
+            live_add(timed_alloc(size), size);
+        } else if (pick < 60) {
+            // Append (fs_append grows with krealloc)
+            uint32_t index = rng() % live_count;
+            uint32_t size = live[index].size + rng_range(16, 512);
+            void* ptr = timed_realloc(live[index].ptr, size);
+            if (ptr != NULL) {
+                live[index].ptr = ptr;
+                live[index].size = size;
+            }
+        } else if (pick < 80) {
+            // Overwrite (fs_write frees and reallocates)
+            uint32_t index = rng() % live_count;
+            uint32_t size = rng_log_size(16, 16384);
+            timed_free(live[index].ptr);
+            live[index].ptr = timed_alloc(size);
+            live[index].size = size;
+            if (live[index].ptr == NULL) {
+                live[index] = live[--live_count];
+            }
+        } else if (pick < 98) {
+            // Delete
+            live_free(rng() % live_count);
+        } else {
+            // Save/load pass: entry table, node table and sector buffers
+            void* entries = timed_alloc(live_count * entry_size);
+            void* nodes = timed_alloc(live_count * sizeof(void*));
+            for (uint32_t i = 0; i < live_count; i++) {
+                void* sectors = timed_alloc((live[i].size + 511) & ~511U);
+                if (sectors != NULL) timed_free(sectors);
+            }
+            if (nodes != NULL) timed_free(nodes);
+            if (entries != NULL) timed_free(entries);
+        }
+    }
+    live_free_all();
+}
+
+// GUI: windows (about 1 KB each with a few small strings) opened and
+// closed in bursts, plus short-lived per-frame temporaries
+static void trace_gui(uint64_t ops) {
+    const uint32_t window_size = 960;
+    const uint32_t max_objects = 12 * 4;
+
+    while (result.ops < ops) {
+        uint32_t pick = rng() % 100;
+
+        if (pick < 10 && live_count + 4 <= max_objects) {
+            // Open a window and its strings
+            live_add(timed_alloc(window_size), window_size);
+            for (int i = 0; i < 3; i++) {
+                uint32_t size = rng_range(8, 32);
+                live_add(timed_alloc(size), size);
+            }
+        } else if (pick < 20 && live_count > 0) {
+            // Close something
+            live_free(rng() % live_count);
+        } else {
+            // One frame worth of temporaries
+            void* temps[8];
+            uint32_t count = rng_range(1, 8);
+            for (uint32_t i = 0; i < count; i++) {
+                temps[i] = timed_alloc(rng_range(64, 512));
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (temps[i] != NULL) timed_free(temps[i]);
+            }
+        }
+    }
+    live_free_all();
+}
+
+// ============================================================================
+// Driver
+// ============================================================================
+
+typedef struct {
+    const char* name;
+    void (*run)(uint64_t ops);
+} trace_t;
+
+static const trace_t traces[] = {
+    { "random", trace_random },
+    { "fs",     trace_fs },
+    { "gui",    trace_gui },
+};
+
+#define TRACE_COUNT (sizeof(traces) / sizeof(traces[0]))
+
+static void run_trace(const trace_t* trace, uint64_t ops, uint32_t seed, unsigned long limit) {
+    memset(&result, 0, sizeof(result));
+    live_count = 0;
+    rng_state = seed;
+    timeline_every = ops / TIMELINE_SAMPLES;
+    next_sample = timeline_every;
+
+    bench_pmm_reset();
+    bench_pmm_set_limit(limit);
+    bench_heap_init();
+
+    printf("[%s]\n", trace->name);
+    printf("  %10s %9s %9s %11s %11s %7s\n", "ops", "used KB", "heap KB", "free blocks", "largest KB", "frag");
+
+    uint64_t start = now_ns();
+    trace->run(ops);
+    uint64_t wall = now_ns() - start;
+
+    bench_heap_stats_t stats;
+    bench_heap_stats(&stats);
+
+    printf("  ops/sec %.2fM  avg %lluns  p50 <%lluns  p99 <%lluns  p99.9 <%lluns  worst %lluns\n",
+           result.ops / (wall / 1e9) / 1e6,
+           (unsigned long long)(result.total_ns / (result.ops ? result.ops : 1)),
+           (unsigned long long)percentile(0.50),
+           (unsigned long long)percentile(0.99),
+           (unsigned long long)percentile(0.999),
+           (unsigned long long)result.worst_ns);
+    printf("  peak used %uKB  failed %llu  leaked %uB  pages held %luKB\n\n",
+           stats.peak_used / 1024, (unsigned long long)result.failures, stats.used,
+           bench_pmm_bytes() / 1024);
+}
+
+int main(int argc, char** argv) {
+    const char* only = NULL;
+    uint64_t ops = 1000000;
+    uint32_t seed = 1;
+    unsigned long limit = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ops = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (seed == 0) seed = 1;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            limit = strtoul(argv[++i], NULL, 10) * 1024;
+        } else if (strcmp(argv[i], "all") != 0) {
+            only = argv[i];
+        }
+    }
+
+    bool found = false;
+    for (size_t i = 0; i < TRACE_COUNT; i++) {
+        if (only == NULL || strcmp(only, traces[i].name) == 0) {
+            run_trace(&traces[i], ops, seed, limit);
+            found = true;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "usage: %s [random|fs|gui|all] [-n ops] [-s seed] [-l limit_kb]\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
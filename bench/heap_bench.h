@@ -0,0 +1,40 @@
+/*
+ * KaiOS - Host Heap Benchmark Interface
+ * Plain-C bridge between the Linux benchmark driver and the kernel heap
+ *
+ * The kernel headers redefine size_t and the string functions, so they
+ * cannot share a translation unit with the C library. The glue and PMM
+ * shim are built like kernel code; the driver only sees this header.
+ */
+
+#ifndef KAIOS_HEAP_BENCH_H
+#define KAIOS_HEAP_BENCH_H
+
+extern "C" {
+
+typedef struct {
+    unsigned int heap_size;
+    unsigned int used;
+    unsigned int free;
+    unsigned int peak_used;
+    unsigned int largest_free;
+    unsigned int free_blocks;
+    unsigned int fragmentation;     // Percent
+    unsigned int failed_count;
+} bench_heap_stats_t;
+
+// Kernel heap entry points
+void bench_heap_init(void);
+void* bench_kmalloc(unsigned int size);
+void* bench_krealloc(void* ptr, unsigned int size);
+void bench_kfree(void* ptr);
+void bench_heap_stats(bench_heap_stats_t* stats);
+
+// Physical memory shim (backs pmm_alloc_pages with host memory)
+void bench_pmm_set_limit(unsigned long bytes);     // 0 = unlimited
+void bench_pmm_reset(void);
+unsigned long bench_pmm_bytes(void);
+
+}
+
+#endif // KAIOS_HEAP_BENCH_H
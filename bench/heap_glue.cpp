@@ -0,0 +1,37 @@
+/*
+ * KaiOS - Host Heap Benchmark Glue
+ * Exposes the kernel heap through the plain-C benchmark interface
+ */
+
+#include "include/kernel/memory.h"
+#include "bench/heap_bench.h"
+
+void bench_heap_init(void) {
+    memory_init();
+}
+
+void* bench_kmalloc(unsigned int size) {
+    return kmalloc(size);
+}
+
+void* bench_krealloc(void* ptr, unsigned int size) {
+    return krealloc(ptr, size);
+}
+
+void bench_kfree(void* ptr) {
+    kfree(ptr);
+}
+
+void bench_heap_stats(bench_heap_stats_t* out) {
+    heap_stats_t stats;
+    memory_get_stats(&stats);
+
+    out->heap_size = stats.heap_size;
+    out->used = stats.used;
+    out->free = stats.free;
+    out->peak_used = stats.peak_used;
+    out->largest_free = stats.largest_free;
+    out->free_blocks = stats.free_blocks;
+    out->fragmentation = stats.fragmentation;
+    out->failed_count = stats.failed_count;
+}
@@ -0,0 +1,62 @@
+/*
+ * KaiOS - Host PMM Shim
+ * Page-frame allocator stand-in for host builds of kernel allocators
+ *
+ * Blocks come from posix_memalign with the natural alignment the buddy
+ * allocator guarantees, optionally capped to model a small machine.
+ */
+
+#include "include/kernel/pmm.h"
+#include "bench/heap_bench.h"
+
+extern "C" int posix_memalign(void** ptr, unsigned long align, unsigned long size);
+extern "C" void free(void* ptr);
+
+static unsigned long limit_bytes = 0;
+static unsigned long live_bytes = 0;
+
+uintptr_t pmm_alloc_pages(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    unsigned long bytes = (unsigned long)PMM_PAGE_SIZE << order;
+    if (limit_bytes != 0 && live_bytes + bytes > limit_bytes) {
+        return 0;
+    }
+
+    void* ptr;
+    if (posix_memalign(&ptr, bytes, bytes) != 0) {
+        return 0;
+    }
+    live_bytes += bytes;
+    return (uintptr_t)ptr;
+}
+
+void pmm_free_pages(uintptr_t addr, uint32_t order) {
+    if (addr == 0) {
+        return;
+    }
+    live_bytes -= (unsigned long)PMM_PAGE_SIZE << order;
+    free((void*)addr);
+}
+
+uint32_t pmm_order_for_size(size_t size) {
+    uint32_t order = 0;
+    while (order <= PMM_MAX_ORDER && ((size_t)PMM_PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+void bench_pmm_set_limit(unsigned long bytes) {
+    limit_bytes = bytes;
+}
+
+void bench_pmm_reset(void) {
+    live_bytes = 0;
+}
+
+unsigned long bench_pmm_bytes(void) {
+    return live_bytes;
+}
@@ -0,0 +1,368 @@
+/*
+ * KaiOS - Host String Benchmark
+ * Checks the kernel's string.cpp against the C library and times both
+ *
+ * Usage: string_bench [-q]
+ *   -q   correctness checks only
+ *
+ * Every routine is first compared with glibc on random inputs, with and
+ * without the SSE2 paths. The timing tables then give cycles per byte
+ * (rdtsc, best of several runs) over a sweep of sizes and misalignments;
+ * "kernel" is the baseline string-instruction path, "sse2" the path
+ * cpu_init selects on SSE2 machines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bench/string_bench.h"
+
+#define BUFFER_SIZE  (2 * 1024 * 1024)
+#define RUNS         5
+#define TARGET_BYTES (4 * 1024 * 1024)     // Work per timed run
+
+static uint8_t* buf_a;
+static uint8_t* buf_b;
+static volatile uintptr_t sink;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("lfence\n\trdtsc" : "=a"(low), "=d"(high) : : "memory");
+    return ((uint64_t)high << 32) | low;
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+// Fill with random letters from a small alphabet so matches are common
+static void random_text(uint8_t* p, size_t len, uint32_t alphabet) {
+    for (size_t i = 0; i < len; i++) {
+        p[i] = 'a' + rng() % alphabet;
+    }
+    p[len] = '\0';
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, size_t size, size_t align) {
+    if (!ok) {
+        if (failures < 20) {
+            printf("  FAIL %s (size %zu, align %zu)\n", what, size, align);
+        }
+        failures++;
+    }
+}
+
+static void check_value(bool ok, const char* what, uint32_t value, int base) {
+    if (!ok) {
+        if (failures < 20) {
+            printf("  FAIL %s (value 0x%x, base %d)\n", what, value, base);
+        }
+        failures++;
+    }
+}
+
+// ============================================================================
+// Correctness against glibc
+// ============================================================================
+
+static void verify_memory(void) {
+    static uint8_t expect[BUFFER_SIZE];
+
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t size = (iter % 50 == 0) ? rng() % (600 * 1024) : rng() % 2048;
+        size_t src_align = rng() % 64;
+        size_t dst_align = rng() % 64;
+        size_t span = size + 128;
+
+        for (size_t i = 0; i < span; i++) {
+            buf_a[i] = rng();
+            buf_b[i] = rng();
+        }
+        memcpy(expect, buf_b, span);
+
+        int value = rng();
+        switch (iter % 4) {
+        case 0:
+            kstr_memcpy(buf_b + dst_align, buf_a + src_align, size);
+            memcpy(expect + dst_align, buf_a + src_align, size);
+            check(memcmp(buf_b, expect, span) == 0, "memcpy", size, dst_align);
+            break;
+        case 1:
+            kstr_memset(buf_b + dst_align, value, size);
+            memset(expect + dst_align, value, size);
+            check(memcmp(buf_b, expect, span) == 0, "memset", size, dst_align);
+            break;
+        case 2:
+            kstr_memmove(buf_b + dst_align, buf_b + src_align, size);
+            memmove(expect + dst_align, expect + src_align, size);
+            check(memcmp(buf_b, expect, span) == 0, "memmove", size, dst_align);
+            break;
+        case 3:
+            memcpy(buf_a + src_align, buf_b + dst_align, size);
+            if (size > 0 && (rng() & 1)) {
+                buf_a[src_align + rng() % size] ^= 1 << (rng() % 8);
+            }
+            check(sign(kstr_memcmp(buf_a + src_align, buf_b + dst_align, size)) ==
+                  sign(memcmp(buf_a + src_align, buf_b + dst_align, size)), "memcmp", size, src_align);
+            break;
+        }
+    }
+}
+
+static void verify_strings(void) {
+    for (int iter = 0; iter < 200000; iter++) {
+        uint32_t alphabet = 2 + rng() % 4;
+        size_t len_a = rng() % 300;
+        size_t align = rng() % 16;
+        char* a = (char*)buf_a + align;
+        char* b = (char*)buf_b + rng() % 16;
+
+        random_text((uint8_t*)a, len_a, alphabet);
+        size_t len_b = len_a ? rng() % len_a : 0;
+        if (rng() & 1) {
+            memcpy(b, a, len_b);
+            b[len_b] = '\0';
+        } else {
+            random_text((uint8_t*)b, len_b % 12, alphabet);
+        }
+
+        check(kstr_strlen(a) == strlen(a), "strlen", len_a, align);
+        check(sign(kstr_strcmp(a, b)) == sign(strcmp(a, b)), "strcmp", len_a, align);
+
+        int c = (rng() % 8 == 0) ? 0 : 'a' + rng() % (alphabet + 1);
+        check(kstr_strchr(a, c) == strchr(a, c), "strchr", len_a, align);
+
+        const char* needle = b + (len_b ? rng() % (strlen(b) + 1) : 0);
+        check(kstr_strstr(a, needle) == strstr(a, needle), "strstr", len_a, align);
+    }
+
+    // Strings ending exactly at the end of the buffer region
+    for (size_t len = 0; len < 64; len++) {
+        char* end = (char*)buf_a + BUFFER_SIZE - 1 - len;
+        random_text((uint8_t*)end, len, 26);
+        check(kstr_strlen(end) == len, "strlen (tail)", len, (uintptr_t)end & 3);
+        check(kstr_strchr(end, '#') == NULL, "strchr (tail)", len, (uintptr_t)end & 3);
+    }
+}
+
+static void verify_conversions(void) {
+    static const int bases[] = { 2, 8, 10, 16, 36 };
+    char got[40], expect[40];
+
+    for (int iter = 0; iter < 200000; iter++) {
+        // Mix of small, large and boundary values
+        uint32_t raw = rng();
+        if (iter % 4 == 0) raw >>= rng() % 32;
+        if (iter == 0) raw = 0x80000000U;
+        if (iter == 1) raw = 0x7FFFFFFFU;
+
+        int base = bases[iter % 5];
+        kstr_utoa(raw, got, base);
+        check_value(strtoul(got, NULL, base) == raw, "utoa", raw, base);
+
+        kstr_itoa((int)raw, got, base);
+        if (base == 10) {
+            snprintf(expect, sizeof(expect), "%d", (int)raw);
+        } else if (base == 16) {
+            snprintf(expect, sizeof(expect), "%x", raw);
+        } else if (base == 8) {
+            snprintf(expect, sizeof(expect), "%o", raw);
+        } else {
+            kstr_utoa(raw, expect, base);
+        }
+        check_value(strcmp(got, expect) == 0, "itoa", raw, base);
+    }
+}
+
+static void verify_all(void) {
+    for (int sse2 = 0; sse2 <= 1; sse2++) {
+        kstr_string_use_sse2(sse2);
+        rng_state = 12345;
+        verify_memory();
+        verify_strings();
+        verify_conversions();
+    }
+    printf("correctness: %s (%d failures)\n\n", failures ? "FAILED" : "ok", failures);
+}
+
+// ============================================================================
+// Timing
+// ============================================================================
+
+enum { OP_MEMCPY, OP_MEMSET, OP_MEMCMP, OP_STRLEN };
+
+static const char* op_names[] = { "memcpy", "memset", "memcmp", "strlen" };
+
+static void run_op(int op, bool kernel, uint8_t* dst, uint8_t* src, size_t size) {
+    switch (op) {
+    case OP_MEMCPY:
+        if (kernel) kstr_memcpy(dst, src, size); else memcpy(dst, src, size);
+        break;
+    case OP_MEMSET:
+        if (kernel) kstr_memset(dst, 0x5A, size); else memset(dst, 0x5A, size);
+        break;
+    case OP_MEMCMP:
+        sink = kernel ? kstr_memcmp(dst, src, size) : memcmp(dst, src, size);
+        break;
+    case OP_STRLEN:
+        sink = kernel ? kstr_strlen((const char*)src) : strlen((const char*)src);
+        break;
+    }
+}
+
+// Best-of-RUNS cycles per byte
+static double time_op(int op, bool kernel, size_t size, size_t align) {
+    uint8_t* dst = buf_b + align;
+    uint8_t* src = buf_a + align / 2;
+
+    // memcmp walks equal buffers, strlen a string of exactly size bytes
+    memset(buf_a, 'x', size + 64);
+    memset(buf_b, 'x', size + 64);
+    src[size] = '\0';
+    dst[size] = '\0';
+
+    size_t reps = TARGET_BYTES / size;
+    if (reps < 4) reps = 4;
+
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        uint64_t start = rdtsc();
+        for (size_t i = 0; i < reps; i++) {
+            run_op(op, kernel, dst, src, size);
+        }
+        double cycles = (double)(rdtsc() - start) / ((double)reps * size);
+        if (cycles < best) best = cycles;
+    }
+    return best;
+}
+
+static void bench_memory_ops(void) {
+    static const size_t sizes[] = { 8, 16, 32, 64, 128, 256, 512, 1024, 4096,
+                                    16384, 64000, 262144, 1048576 };
+    static const size_t aligns[] = { 0, 1, 3, 8 };
+
+    for (int op = OP_MEMCPY; op <= OP_STRLEN; op++) {
+        printf("%s (cycles/byte; dst misalignment, src misalignment = half)\n", op_names[op]);
+        printf("  %8s %5s %8s %8s %8s\n", "size", "align", "kernel", "sse2", "glibc");
+
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+                kstr_string_use_sse2(false);
+                double base = time_op(op, true, sizes[s], aligns[a]);
+                kstr_string_use_sse2(true);
+                double sse2 = time_op(op, true, sizes[s], aligns[a]);
+                double libc = time_op(op, false, sizes[s], aligns[a]);
+                printf("  %8zu %5zu %8.3f %8.3f %8.3f\n", sizes[s], aligns[a], base, sse2, libc);
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void bench_strstr(void) {
+    static const size_t haystacks[] = { 64, 1024, 16384 };
+    static const size_t needles[] = { 1, 4, 16, 64 };
+
+    printf("strstr (cycles/haystack byte, needle absent)\n");
+    printf("  %8s %6s %8s %8s\n", "haystack", "needle", "kernel", "glibc");
+
+    for (size_t h = 0; h < sizeof(haystacks) / sizeof(haystacks[0]); h++) {
+        for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); n++) {
+            rng_state = 99;
+            random_text(buf_a, haystacks[h], 26);
+            random_text(buf_b, needles[n], 26);
+            buf_b[needles[n] - 1] = '#';
+
+            double result[2];
+            for (int kernel = 0; kernel <= 1; kernel++) {
+                size_t reps = TARGET_BYTES / haystacks[h] / 4 + 1;
+                double best = 1e30;
+                for (int run = 0; run < RUNS; run++) {
+                    uint64_t start = rdtsc();
+                    for (size_t i = 0; i < reps; i++) {
+                        sink = (uintptr_t)(kernel ? kstr_strstr((const char*)buf_a, (const char*)buf_b)
+                                                  : strstr((const char*)buf_a, (const char*)buf_b));
+                    }
+                    double cycles = (double)(rdtsc() - start) / ((double)reps * haystacks[h]);
+                    if (cycles < best) best = cycles;
+                }
+                result[kernel] = best;
+            }
+            printf("  %8zu %6zu %8.3f %8.3f\n", haystacks[h], needles[n], result[1], result[0]);
+        }
+    }
+    printf("\n");
+}
+
+static void bench_conversions(void) {
+    static const uint32_t values[] = { 7, 4096, 1234567, 4000000000U };
+    char out[40];
+
+    printf("itoa/utoa (cycles/call, base 10 and 16; glibc = snprintf)\n");
+    printf("  %10s %8s %8s %8s %8s\n", "value", "itoa", "utoa", "utoa16", "snprintf");
+
+    for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+        double result[4];
+        for (int kind = 0; kind < 4; kind++) {
+            double best = 1e30;
+            for (int run = 0; run < RUNS; run++) {
+                uint64_t start = rdtsc();
+                for (int i = 0; i < 100000; i++) {
+                    switch (kind) {
+                    case 0: kstr_itoa((int)values[v], out, 10); break;
+                    case 1: kstr_utoa(values[v], out, 10); break;
+                    case 2: kstr_utoa(values[v], out, 16); break;
+                    case 3: snprintf(out, sizeof(out), "%u", values[v]); break;
+                    }
+                    sink = out[0];
+                }
+                double cycles = (double)(rdtsc() - start) / 100000;
+                if (cycles < best) best = cycles;
+            }
+            result[kind] = best;
+        }
+        printf("  %10u %8.1f %8.1f %8.1f %8.1f\n", values[v], result[0], result[1], result[2], result[3]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "-q") == 0;
+
+    buf_a = (uint8_t*)aligned_alloc(64, BUFFER_SIZE);
+    buf_b = (uint8_t*)aligned_alloc(64, BUFFER_SIZE);
+    if (buf_a == NULL || buf_b == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    verify_all();
+    if (failures == 0 && !quick) {
+        bench_memory_ops();
+        bench_strstr();
+        bench_conversions();
+    }
+
+    free(buf_a);
+    free(buf_b);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * KaiOS - Host String Benchmark Interface
+ * The kernel's string routines as built by the host benchmark
+ *
+ * string.cpp is compiled with bench/string_rename.h force-included, which
+ * renames every routine to kstr_*. The kernel's size_t is 32 bits, hence
+ * the unsigned int sizes.
+ */
+
+#ifndef KAIOS_STRING_BENCH_H
+#define KAIOS_STRING_BENCH_H
+
+unsigned int kstr_strlen(const char* str);
+int kstr_strcmp(const char* s1, const char* s2);
+char* kstr_strchr(const char* str, int c);
+char* kstr_strstr(const char* haystack, const char* needle);
+
+void* kstr_memset(void* ptr, int value, unsigned int num);
+void* kstr_memcpy(void* dest, const void* src, unsigned int num);
+void* kstr_memmove(void* dest, const void* src, unsigned int num);
+int kstr_memcmp(const void* ptr1, const void* ptr2, unsigned int num);
+void kstr_string_use_sse2(bool enabled);
+
+char* kstr_itoa(int value, char* str, int base);
+char* kstr_utoa(unsigned int value, char* str, int base);
+
+#endif // KAIOS_STRING_BENCH_H
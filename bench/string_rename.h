@@ -0,0 +1,35 @@
+/*
+ * KaiOS - Host String Benchmark Renames
+ * Force-included when building string.cpp for the host so the kernel's
+ * routines get kstr_ names and can be linked next to the C library's
+ */
+
+#ifndef KAIOS_STRING_RENAME_H
+#define KAIOS_STRING_RENAME_H
+
+#define strlen           kstr_strlen
+#define strcpy           kstr_strcpy
+#define strncpy          kstr_strncpy
+#define strcmp           kstr_strcmp
+#define strncmp          kstr_strncmp
+#define strcat           kstr_strcat
+#define strchr           kstr_strchr
+#define strrchr          kstr_strrchr
+#define strstr           kstr_strstr
+#define memset           kstr_memset
+#define memcpy           kstr_memcpy
+#define memmove          kstr_memmove
+#define memcmp           kstr_memcmp
+#define memcpy_stream    kstr_memcpy_stream
+#define string_use_sse2  kstr_string_use_sse2
+#define atoi             kstr_atoi
+#define itoa             kstr_itoa
+#define utoa             kstr_utoa
+#define isdigit          kstr_isdigit
+#define isalpha          kstr_isalpha
+#define isalnum          kstr_isalnum
+#define isspace          kstr_isspace
+#define toupper          kstr_toupper
+#define tolower          kstr_tolower
+
+#endif // KAIOS_STRING_RENAME_H
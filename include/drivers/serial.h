@@ -0,0 +1,31 @@
+/*
+ * KaiOS - Serial Port Driver Header
+ * Polled output on COM1 for kernel messages (qemu -serial stdio)
+ */
+
+#ifndef KAIOS_SERIAL_H
+#define KAIOS_SERIAL_H
+
+#include "include/kernel/types.h"
+
+// COM1 registers (offsets from the base port)
+#define SERIAL_COM1              0x3F8
+#define SERIAL_DATA              0
+#define SERIAL_INT_ENABLE        1
+#define SERIAL_FIFO_CONTROL      2
+#define SERIAL_LINE_CONTROL      3
+#define SERIAL_MODEM_CONTROL     4
+#define SERIAL_LINE_STATUS       5
+
+// Line status bits
+#define SERIAL_LSR_THR_EMPTY     0x20
+
+#define SERIAL_BAUD_DIVISOR      3      // 115200 / 3 = 38400 baud
+
+// Serial functions
+void serial_init(void);
+bool serial_is_present(void);
+void serial_putchar(char c);
+void serial_write(const char* data, size_t size);
+
+#endif // KAIOS_SERIAL_H
@@ -0,0 +1,58 @@
+/*
+ * KaiOS - Arena Allocator Header
+ * Bump-pointer allocation for short-lived scratch memory
+ *
+ * An arena hands out memory by advancing a pointer through chunks taken
+ * straight from the page-frame allocator, so transient buffers never touch
+ * (or fragment) the kmalloc heap. Nothing is freed individually: callers
+ * take a mark and later release everything allocated since, or reset the
+ * whole arena.
+ */
+
+#ifndef KAIOS_ARENA_H
+#define KAIOS_ARENA_H
+
+#include "include/kernel/types.h"
+
+#define ARENA_ALIGN          8
+#define ARENA_DEFAULT_CHUNK  16384
+
+// Chunk header (start of each block of pages owned by an arena)
+typedef struct arena_chunk {
+    struct arena_chunk* prev;   // Previously filled chunk
+    uint32_t order;             // Buddy order of the backing pages
+    size_t size;                // Usable bytes after the header
+    size_t used;
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t* current;     // Chunk being bumped (newest)
+    size_t chunk_size;          // Size of regular chunks, header included
+    size_t peak;                // Most bytes ever live at once
+    size_t live;                // Bytes handed out since the last reset
+} arena_t;
+
+// Position to roll back to with arena_release
+typedef struct {
+    arena_chunk_t* chunk;
+    size_t used;
+    size_t live;
+} arena_mark_t;
+
+// Setup/teardown (chunk_size 0 = ARENA_DEFAULT_CHUNK). No memory is taken
+// until the first allocation.
+void arena_init(arena_t* arena, size_t chunk_size);
+void arena_destroy(arena_t* arena);
+
+// Allocation (ARENA_ALIGN aligned, NULL when out of memory)
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_calloc(arena_t* arena, size_t size);
+
+// Scoped release
+arena_mark_t arena_mark(arena_t* arena);
+void arena_release(arena_t* arena, arena_mark_t mark);
+
+// Drop everything, keeping one regular chunk for the next round
+void arena_reset(arena_t* arena);
+
+#endif // KAIOS_ARENA_H
@@ -0,0 +1,97 @@
+/*
+ * KaiOS - CPU Feature Header
+ * CPUID feature detection and control/model-specific register access
+ */
+
+#ifndef KAIOS_CPU_H
+#define KAIOS_CPU_H
+
+#include "include/kernel/types.h"
+
+// CPUID leaf 1 EDX feature bits
+#define CPU_FEATURE_FPU   (1U << 0)
+#define CPU_FEATURE_PSE   (1U << 3)     // 4 MB pages
+#define CPU_FEATURE_MSR   (1U << 5)     // rdmsr/wrmsr
+#define CPU_FEATURE_PGE   (1U << 13)    // Global pages
+#define CPU_FEATURE_PAT   (1U << 16)    // Page attribute table
+#define CPU_FEATURE_FXSR  (1U << 24)    // fxsave/fxrstor
+#define CPU_FEATURE_SSE   (1U << 25)
+#define CPU_FEATURE_SSE2  (1U << 26)
+
+// Control register bits
+#define CR0_MP            (1U << 1)     // Monitor coprocessor (wait honours TS)
+#define CR0_EM            (1U << 2)     // x87 emulation (must be clear for SSE)
+#define CR0_TS            (1U << 3)     // Task switched (lazy FPU trap)
+#define CR0_WP            (1U << 16)    // Honour read-only pages in ring 0
+#define CR0_PG            (1U << 31)
+#define CR4_PSE           (1U << 4)
+#define CR4_OSFXSR        (1U << 9)     // OS supports fxsave/fxrstor and SSE
+#define CR4_OSXMMEXCPT    (1U << 10)    // OS handles SIMD exceptions (#XM)
+
+// Model-specific registers
+#define MSR_PAT           0x277
+
+// Register access
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void invlpg(uintptr_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Feature detection (cpu_init must run before cpu_has_feature). cpu_init
+// also enables SSE when the CPU has it; interrupt handlers must not use
+// SSE code paths since XMM state is not saved across interrupts.
+void cpu_init(void);
+bool cpu_has_feature(uint32_t feature);
+bool cpu_sse_enabled(void);
+const char* cpu_vendor(void);
+
+#endif // KAIOS_CPU_H
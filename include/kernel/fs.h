@@ -11,9 +11,12 @@
 // File system constants
 #define FS_MAX_NAME       64
 #define FS_MAX_PATH       256
-#define FS_MAX_FILES      128
-#define FS_MAX_FILE_SIZE  65536
-#define FS_MAX_CHILDREN   32
+
+// File data is stored in extents of FS_EXTENT_SIZE bytes. All but the last
+// are full; the last one grows by doubling up to FS_EXTENT_SIZE, so small
+// files stay small and appends only ever touch the tail.
+#define FS_EXTENT_SHIFT   12
+#define FS_EXTENT_SIZE    (1U << FS_EXTENT_SHIFT)
 
 // File types
 typedef enum {
@@ -21,19 +24,96 @@ typedef enum {
     FS_DIRECTORY = 1
 } fs_type_t;
 
-// File node structure
+// File contents. A copy shares its source's fs_data_t; whichever file is
+// written first gets a private duplicate (copy-on-write). Contents loaded
+// from disk stay there until first used, and clean contents go back to
+// being disk-only under memory pressure.
+typedef struct fs_data {
+    uint32_t refcount;
+    uint8_t** extents;          // See FS_EXTENT_SIZE
+    size_t extent_count;
+    size_t extent_slots;        // Capacity of extents[]
+    size_t tail_capacity;       // Bytes allocated for the last extent
+    uint32_t disk_sector;       // Run reserved in the disk image, 0 if none
+    uint32_t disk_sectors;
+    size_t dirty_from;          // Bytes changed since the last save
+    size_t dirty_to;
+    uint32_t save_pass;         // Last fs_save that moved the run
+    bool evicted;               // No extents; read the run on first use
+} fs_data_t;
+
+#define FS_SHRINKER_PRIORITY 10     // Evicted data costs a disk read
+
+// Nodes come in two layouts that share the fs_node_t header: files
+// (fs_file_node_t) and directories (fs_dir_node_t). Names shorter than
+// FS_INLINE_NAME and file contents up to FS_INLINE_DATA bytes are stored
+// inside the node itself.
+#define FS_INLINE_NAME    16
+#define FS_INLINE_DATA    16
+
+// Node flags
+#define FS_NODE_INLINE    0x01      // File data lives in inline_data
+
+// Common node header
 typedef struct fs_node {
-    char name[FS_MAX_NAME];
-    fs_type_t type;
-    size_t size;
-    uint8_t* data;
+    char* name;                 // Inline buffer or heap
+    uint32_t name_hash;
     struct fs_node* parent;
-    struct fs_node* children[FS_MAX_CHILDREN];
-    size_t child_count;
+    size_t size;                // File size, 0 for directories
     uint32_t created;
     uint32_t modified;
+    uint32_t slot;              // Entry in the disk image + 1, 0 if unsaved
+    uint8_t type;               // fs_type_t
+    uint8_t flags;
 } fs_node_t;
 
+typedef struct {
+    fs_node_t node;
+    union {
+        fs_data_t* data;        // NULL while the file is empty
+        uint8_t inline_data[FS_INLINE_DATA];
+    };
+    char inline_name[FS_INLINE_NAME];
+} fs_file_node_t;
+
+// A directory keeps its children twice: in creation order in children[]
+// (what fs_readdir returns) and in an open-addressing hash table keyed on
+// each child's name_hash for lookups. Both grow on demand.
+typedef struct {
+    fs_node_t node;
+    fs_node_t** children;
+    size_t child_count;
+    size_t child_capacity;
+    fs_node_t** index;          // Hash slots (NULL = empty), linear probing
+    size_t index_capacity;      // Power of two, 0 until the first child
+    char* path;                 // Cached canonical path
+    size_t path_len;
+    uint32_t path_gen;          // Valid while equal to the fs path generation
+    char inline_name[FS_INLINE_NAME];
+} fs_dir_node_t;
+
+// Open flags
+#define FS_O_READ     0x01
+#define FS_O_WRITE    0x02
+#define FS_O_CREATE   0x04      // Create the file if it does not exist
+#define FS_O_TRUNC    0x08      // Discard the contents (with FS_O_WRITE)
+#define FS_O_APPEND   0x10      // Every write goes to the end
+
+// Seek origins
+#define FS_SEEK_SET   0
+#define FS_SEEK_CUR   1
+#define FS_SEEK_END   2
+
+#define FS_MAX_OPEN   16
+
+// Open file: a node plus a cursor. Handles live in a fixed table; an open
+// file cannot be deleted.
+typedef struct {
+    fs_node_t* node;            // NULL when the slot is free
+    size_t offset;
+    int flags;
+} fs_file_t;
+
 // File system functions
 void fs_init(void);
 fs_node_t* fs_get_root(void);
@@ -58,13 +138,29 @@ int fs_append(fs_node_t* file, const void* data, size_t size);
 int fs_read(fs_node_t* file, void* buffer, size_t size, size_t offset);
 fs_node_t* fs_find(const char* name);
 
+// Open file handles
+fs_file_t* fs_open(const char* path, int flags);
+void fs_close(fs_file_t* file);
+int fs_file_read(fs_file_t* file, void* buffer, size_t size);
+int fs_file_write(fs_file_t* file, const void* data, size_t size);
+int fs_seek(fs_file_t* file, int offset, int whence);
+
+// Zero-copy read: returns the contiguous bytes at the cursor (up to the end
+// of one extent), stores their count in length and advances past them.
+// NULL at end of file. The pointer is valid until the file is next written.
+const uint8_t* fs_view(fs_file_t* file, size_t* length);
+
 // Utility functions
 int fs_rename(const char* old_name, const char* new_name);
 int fs_copy(const char* src, const char* dest);
 
-// Persistence functions
+// Persistence functions. fs_save writes only the entries and file data
+// changed since the previous save (everything, the first time), as one
+// journaled transaction: after a crash fs_load finds either the previous
+// save or the new one.
 bool fs_save(void);
 bool fs_load(void);
 bool fs_has_disk(void);
+uint32_t fs_last_save_sectors(void);    // Sectors written by the last fs_save
 
 #endif // KAIOS_FS_H
@@ -1,5 +1,10 @@
 /*
  * KaiOS - Memory Management Header
+ * TLSF (two-level segregated fit) heap allocator
+ *
+ * The heap is a set of pools obtained from the page-frame allocator. It
+ * starts with one HEAP_INITIAL_SIZE pool and grows by whole buddy blocks
+ * when a request cannot be satisfied.
  */
 
 #ifndef KAIOS_MEMORY_H
@@ -9,20 +14,107 @@
 
 // Memory constants
 #define PAGE_SIZE 4096
-#define HEAP_START 0x100000   // 1 MB
-#define HEAP_SIZE  0x400000   // 4 MB heap
+#define HEAP_INITIAL_SIZE 0x100000   // 1 MB arena at boot
+#define HEAP_GROW_MIN     0x40000    // Grow the arena by at least 256 KB
+
+// Allocation granularity
+#define HEAP_ALIGN_LOG2 3
+#define HEAP_ALIGN      (1 << HEAP_ALIGN_LOG2)
+
+// TLSF index parameters: every power-of-two range (first level) is split
+// into 16 linear subranges (second level). Blocks below 128 bytes all live
+// in first level 0, indexed linearly in 8-byte steps.
+#define TLSF_SL_INDEX_COUNT_LOG2 4
+#define TLSF_SL_INDEX_COUNT      (1 << TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_FL_INDEX_MAX        30
+#define TLSF_FL_INDEX_SHIFT      (TLSF_SL_INDEX_COUNT_LOG2 + HEAP_ALIGN_LOG2)
+#define TLSF_FL_INDEX_COUNT      (TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+#define TLSF_SMALL_BLOCK_SIZE    (1 << TLSF_FL_INDEX_SHIFT)
 
 // Memory block header
+//
+// Every block starts with a boundary tag (prev_phys + size). The low bits
+// of size carry the block's own free flag and the free flag of the block
+// physically before it, so both neighbours can be coalesced in O(1).
+// next_free/prev_free overlay the first bytes of the payload and are only
+// meaningful while the block sits on a free list. KMALLOC_TRACE builds add
+// the allocating call site to the header (two words, keeping the payload
+// HEAP_ALIGN aligned).
 typedef struct memory_block {
+    struct memory_block* prev_phys;
     size_t size;
-    bool free;
-    struct memory_block* next;
-    struct memory_block* prev;
+#ifdef KMALLOC_TRACE
+    void* caller;           // Return address of the allocating call
+    size_t request;         // Bytes requested by the caller
+#endif
+    struct memory_block* next_free;
+    struct memory_block* prev_free;
 } memory_block_t;
 
+// Heap pool header (start of every arena region taken from the PMM)
+typedef struct heap_pool {
+    struct heap_pool* next;
+    struct heap_pool* prev;
+    uint32_t order;         // Buddy order of the backing pages
+    uint32_t reserved;
+} heap_pool_t;
+
+// Allocation size histogram: bucket i counts requests of up to
+// (1 << (HEAP_HIST_MIN_LOG2 + i)) bytes, the last bucket everything larger
+#define HEAP_HIST_BUCKETS  16
+#define HEAP_HIST_MIN_LOG2 4
+
+// Heap statistics snapshot (all counters are maintained incrementally)
+typedef struct {
+    size_t heap_size;           // Bytes in all pools, headers included
+    size_t used;                // Payload bytes handed out
+    size_t free;                // Payload bytes on the free lists
+    size_t peak_used;           // High-water mark of used
+    size_t largest_free;        // Largest block available without growing
+    uint32_t pools;
+    uint32_t free_blocks;
+    uint32_t alloc_count;
+    uint32_t free_count;
+    uint32_t failed_count;      // Requests that could not be satisfied
+    uint32_t reclaim_count;     // Shrinker passes run under pressure
+    size_t reclaimed;           // Bytes the shrinkers gave back
+    uint32_t fragmentation;     // Percent of free bytes outside the largest block
+    uint32_t histogram[HEAP_HIST_BUCKETS];
+} heap_stats_t;
+
+// Memory-pressure shrinkers. A shrinker frees up to bytes of cached memory
+// (heap blocks or whole pages) and returns how much it released. When a
+// request cannot be met, kmalloc runs them in ascending priority order,
+// cheapest caches first, and retries before giving up.
+#define SHRINKER_MAX 8
+
+typedef size_t (*shrinker_fn_t)(size_t bytes);
+
+bool memory_register_shrinker(const char* name, shrinker_fn_t fn, int priority);
+void memory_unregister_shrinker(shrinker_fn_t fn);
+size_t memory_reclaim(size_t bytes);
+
+#ifdef KMALLOC_TRACE
+// Call sites tracked by KMALLOC_TRACE builds (sites beyond this are
+// lumped together under a NULL caller)
+#define KMALLOC_TRACE_SITES 256
+
+// Live allocations attributed to one call site
+typedef struct {
+    void* caller;
+    size_t live_bytes;          // Block bytes currently held
+    uint32_t live_count;        // Blocks currently held
+    uint32_t total_count;       // Allocations ever made from this site
+} kmalloc_site_t;
+
+// Copy up to max call sites, largest live_bytes first. Returns the count.
+size_t memory_trace_top(kmalloc_site_t* sites, size_t max);
+#endif
+
 // Memory management functions
 void memory_init(void);
 void* kmalloc(size_t size);
+void* kmalloc_aligned(size_t size, size_t align);
 void* kcalloc(size_t num, size_t size);
 void* krealloc(void* ptr, size_t size);
 void kfree(void* ptr);
@@ -30,5 +122,6 @@ void kfree(void* ptr);
 // Memory info
 size_t memory_used(void);
 size_t memory_free(void);
+void memory_get_stats(heap_stats_t* stats);
 
 #endif // KAIOS_MEMORY_H
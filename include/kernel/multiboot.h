@@ -0,0 +1,67 @@
+/*
+ * KaiOS - Multiboot Information Header
+ * Structures passed to the kernel by a Multiboot 1 bootloader
+ */
+
+#ifndef KAIOS_MULTIBOOT_H
+#define KAIOS_MULTIBOOT_H
+
+#include "include/kernel/types.h"
+
+// Multiboot magic number check
+#define MULTIBOOT_MAGIC 0x2BADB002
+
+// Multiboot info flags
+#define MULTIBOOT_INFO_MEMORY   0x001   // mem_lower/mem_upper valid
+#define MULTIBOOT_INFO_CMDLINE  0x004   // cmdline valid
+#define MULTIBOOT_INFO_MEM_MAP  0x040   // mmap_length/mmap_addr valid
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x1000 // framebuffer_* fields valid
+
+// Memory map region types
+#define MULTIBOOT_MEMORY_AVAILABLE        1
+#define MULTIBOOT_MEMORY_RESERVED         2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS              4
+#define MULTIBOOT_MEMORY_BADRAM           5
+
+// Multiboot info structure
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;         // KB of memory below 1 MB
+    uint32_t mem_upper;         // KB of memory above 1 MB
+    uint32_t boot_device;
+    uint32_t cmdline;           // Physical address of command line
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;       // Size of the memory map buffer in bytes
+    uint32_t mmap_addr;         // Physical address of the memory map
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+    uint64_t framebuffer_addr;  // Physical address of the linear framebuffer
+    uint32_t framebuffer_pitch; // Bytes per scanline
+    uint32_t framebuffer_width;
+    uint32_t framebuffer_height;
+    uint8_t  framebuffer_bpp;
+    uint8_t  framebuffer_type;
+    uint8_t  color_info[6];
+} PACKED multiboot_info_t;
+
+// Memory map entry (size does not include the size field itself)
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} PACKED multiboot_mmap_entry_t;
+
+#endif // KAIOS_MULTIBOOT_H
@@ -0,0 +1,54 @@
+/*
+ * KaiOS - Paging Header
+ * Identity-mapped 32-bit paging with 4 MB pages and PAT memory types
+ */
+
+#ifndef KAIOS_PAGING_H
+#define KAIOS_PAGING_H
+
+#include "include/kernel/types.h"
+#include "include/kernel/multiboot.h"
+
+// Page sizes
+#define PAGE_SIZE         4096
+#define LARGE_PAGE_SIZE   0x400000  // PSE page
+
+// Page directory/table entry bits
+#define PAGE_PRESENT      0x001
+#define PAGE_WRITE        0x002
+#define PAGE_USER         0x004
+#define PAGE_PWT          0x008
+#define PAGE_PCD          0x010
+#define PAGE_ACCESSED     0x020
+#define PAGE_DIRTY        0x040
+#define PAGE_LARGE        0x080     // PS bit in a directory entry
+#define PAGE_PAT          0x080     // PAT bit in a 4 KB table entry
+#define PAGE_PAT_LARGE    0x1000    // PAT bit in a 4 MB directory entry
+
+// Memory types for paging_map (PAT entry selected by PCD/PWT).
+// Entry 1 is reprogrammed from write-through to write-combining.
+#define PAGE_CACHE_WB     0
+#define PAGE_CACHE_WC     PAGE_PWT
+#define PAGE_CACHE_UC     (PAGE_PCD | PAGE_PWT)
+#define PAGE_CACHE_MASK   (PAGE_PCD | PAGE_PWT)
+
+// Legacy VGA graphics window (mode 13h framebuffer)
+#define VGA_FRAMEBUFFER      0xA0000
+#define VGA_FRAMEBUFFER_SIZE 0x10000
+
+// Initialization: identity-map usable RAM, protect the kernel image,
+// map framebuffers write-combining and enable paging
+void paging_init(multiboot_info_t* mboot_info);
+bool paging_enabled(void);
+bool paging_write_combining(void);
+
+// Map [phys, phys + size) at virt with PAGE_* flags (PAGE_PRESENT is
+// implied). Uses 4 MB pages where alignment allows. Returns false when a
+// page table cannot be allocated.
+bool paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint32_t flags);
+void paging_unmap(uintptr_t virt, size_t size);
+
+// Physical address for virt, or 0 if it is not mapped
+uintptr_t paging_translate(uintptr_t virt);
+
+#endif // KAIOS_PAGING_H
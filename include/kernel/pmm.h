@@ -0,0 +1,37 @@
+/*
+ * KaiOS - Physical Memory Manager Header
+ * Buddy-system page-frame allocator
+ */
+
+#ifndef KAIOS_PMM_H
+#define KAIOS_PMM_H
+
+#include "include/kernel/types.h"
+#include "include/kernel/multiboot.h"
+
+// Page frames
+#define PMM_PAGE_SIZE   4096
+#define PMM_PAGE_SHIFT  12
+
+// Largest block is 2^PMM_MAX_ORDER pages (4 MB)
+#define PMM_MAX_ORDER   10
+#define PMM_ORDER_COUNT (PMM_MAX_ORDER + 1)
+
+// Initialization (builds the free lists from the multiboot memory map)
+void pmm_init(multiboot_info_t* mboot_info);
+
+// Allocate/free 2^order contiguous, naturally aligned pages.
+// Returns the physical address, or 0 when no block is available.
+uintptr_t pmm_alloc_pages(uint32_t order);
+void pmm_free_pages(uintptr_t addr, uint32_t order);
+
+// Smallest order whose block holds at least size bytes
+// (PMM_MAX_ORDER + 1 if size exceeds the largest block)
+uint32_t pmm_order_for_size(size_t size);
+
+// Memory info
+size_t pmm_total_pages(void);
+size_t pmm_free_page_count(void);
+uintptr_t pmm_highest_address(void);
+
+#endif // KAIOS_PMM_H
@@ -0,0 +1,38 @@
+/*
+ * KaiOS - Formatted Output Header
+ * printf-style formatting into buffers, the console and the kernel log
+ *
+ * Conversions: %d %i %u %x %X %o %c %s %p %%
+ * Flags:       '-' left-justify, '0' zero-pad, '+' and ' ' sign, '#' prefix
+ * Width and precision take a number or '*'; length modifiers hh, h, l,
+ * ll (64-bit) and z are accepted.
+ *
+ * Output is staged in a small buffer and handed to the sinks in bulk, so
+ * the console cursor moves once per flush rather than once per character.
+ */
+
+#ifndef KAIOS_PRINTF_H
+#define KAIOS_PRINTF_H
+
+#include <stdarg.h>
+#include "include/kernel/types.h"
+
+#define KPRINTF_BUFFER_SIZE  128
+#define KLOG_SIZE            8192      // Kernel log ring (power of two)
+
+// Format into a buffer; returns the length the full output would have
+// (output is truncated to size - 1 characters and always terminated)
+int kvsnprintf(char* buffer, size_t size, const char* format, va_list args);
+int ksnprintf(char* buffer, size_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Console output (VGA text screen, mirrored to the serial port)
+int kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Kernel log (ring buffer read by dmesg, mirrored to the serial port)
+int klog(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Copy the most recent log text (up to size bytes); returns bytes copied
+size_t klog_read(char* out, size_t size);
+
+#endif // KAIOS_PRINTF_H
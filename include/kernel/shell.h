@@ -6,6 +6,7 @@
 #define KAIOS_SHELL_H
 
 #include "include/kernel/types.h"
+#include "include/kernel/arena.h"
 
 // Shell constants
 #define SHELL_MAX_INPUT    256
@@ -17,6 +18,9 @@ void shell_init(void);
 void shell_run(void);
 void shell_process_command(char* input);
 
+// Scratch memory for the running command (reset after every command)
+arena_t* shell_arena(void);
+
 // Built-in commands
 void cmd_help(int argc, char** argv);
 void cmd_clear(int argc, char** argv);
@@ -33,6 +37,10 @@ void cmd_write(int argc, char** argv);
 void cmd_cp(int argc, char** argv);
 void cmd_mv(int argc, char** argv);
 void cmd_free(int argc, char** argv);
+void cmd_heapstat(int argc, char** argv);
+void cmd_kmtrace(int argc, char** argv);
+void cmd_slabinfo(int argc, char** argv);
+void cmd_dmesg(int argc, char** argv);
 void cmd_uname(int argc, char** argv);
 void cmd_date(int argc, char** argv);
 void cmd_uptime(int argc, char** argv);
@@ -0,0 +1,76 @@
+/*
+ * KaiOS - Slab Allocator Header
+ * Object caches for fixed-size kernel objects
+ */
+
+#ifndef KAIOS_SLAB_H
+#define KAIOS_SLAB_H
+
+#include "include/kernel/types.h"
+
+// Slab constants
+#define SLAB_CACHE_LINE   64        // Default object alignment
+#define SLAB_MIN_SIZE     4096      // Smallest slab
+#define SLAB_MAX_SIZE     65536     // Largest slab
+#define SLAB_MIN_OBJECTS  8         // Grow slabs until this many objects fit
+#define SLAB_MAX_CACHES   16
+#define SLAB_NAME_MAX     16
+#define SLAB_SHRINKER_PRIORITY 0    // Spare slabs are the cheapest to drop
+
+struct slab_cache;
+
+// Slab header (lives at the start of each slab, slabs are aligned to their
+// own size so an object's slab is found by masking its address). The
+// per-slab free bitmap follows the header, then the objects.
+typedef struct slab {
+    struct slab_cache* cache;
+    struct slab* next;
+    struct slab* prev;
+    uint8_t* objects;       // First object
+    uint16_t inuse;         // Objects handed out
+    uint16_t bump;          // Objects [bump, capacity) have never been used
+} slab_t;
+
+// Object cache
+typedef struct slab_cache {
+    char name[SLAB_NAME_MAX];
+    size_t object_size;     // Size requested at creation
+    size_t stride;          // Object size rounded up to the alignment
+    size_t align;
+    size_t slab_size;
+    uint16_t capacity;      // Objects per slab
+    uint16_t map_words;     // 32-bit free bitmap words per slab
+    slab_t* partial;        // Slabs with free objects
+    slab_t* full;           // Slabs with no free objects
+    slab_t* empty;          // Spare slab kept to absorb alloc/free churn
+    uint32_t slab_count;
+    uint32_t objects_inuse;
+    uint32_t alloc_count;
+    uint32_t free_count;
+} slab_cache_t;
+
+// Per-cache statistics
+typedef struct {
+    const char* name;
+    size_t object_size;
+    size_t stride;
+    size_t slab_size;
+    uint32_t objects_per_slab;
+    uint32_t slabs;
+    uint32_t objects_inuse;
+    uint32_t objects_total;
+    uint32_t alloc_count;
+    uint32_t free_count;
+} slab_stats_t;
+
+// Cache management (align 0 = cache-line aligned)
+slab_cache_t* slab_cache_create(const char* name, size_t size, size_t align);
+void slab_cache_get_stats(slab_cache_t* cache, slab_stats_t* stats);
+size_t slab_cache_count(void);
+slab_cache_t* slab_cache_get(size_t index);
+
+// Object allocation
+void* slab_alloc(slab_cache_t* cache);
+void slab_free(slab_cache_t* cache, void* obj);
+
+#endif // KAIOS_SLAB_H
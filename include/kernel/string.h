@@ -24,6 +24,13 @@ void* memcpy(void* dest, const void* src, size_t num);
 void* memmove(void* dest, const void* src, size_t num);
 int memcmp(const void* ptr1, const void* ptr2, size_t num);
 
+// Copy into memory that will not be read back soon (framebuffers): uses
+// non-temporal stores that bypass the cache when SSE2 is available
+void* memcpy_stream(void* dest, const void* src, size_t num);
+
+// Select the SSE2 implementations (called by cpu_init once SSE is enabled)
+void string_use_sse2(bool enabled);
+
 // Conversion functions
 int atoi(const char* str);
 char* itoa(int value, char* str, int base);
@@ -21,6 +21,9 @@ typedef signed long long   int64_t;
 typedef uint32_t size_t;
 typedef int32_t  ssize_t;
 
+// Pointer-sized integer (unsigned long is pointer-sized on ILP32 and LP64)
+typedef unsigned long uintptr_t;
+
 // Null pointer
 #define NULL 0
 #define nullptr 0
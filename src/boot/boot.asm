@@ -153,6 +153,7 @@ isr_common_stub:
     mov es, ax
     mov fs, ax
     mov gs, ax
+    cld                   ; C code expects DF=0 (memmove may be interrupted mid-std)
     push esp              ; Push pointer to registers_t structure
     call isr_handler
     add esp, 4            ; Clean up pushed pointer
@@ -175,6 +176,7 @@ irq_common_stub:
     mov es, ax
     mov fs, ax
     mov gs, ax
+    cld                   ; C code expects DF=0 (memmove may be interrupted mid-std)
     push esp              ; Push pointer to registers_t structure
     call irq_handler
     add esp, 4            ; Clean up pushed pointer
@@ -267,7 +267,12 @@ uint8_t gfx_getpixel(int16_t x, int16_t y) {
 }
 
 void gfx_swap_buffers(void) {
-    memcpy(VGA_MEMORY, back_buffer, GFX_WIDTH * GFX_HEIGHT);
+    // The frame is never read back, so stream it past the cache
+    memcpy_stream(VGA_MEMORY, back_buffer, GFX_WIDTH * GFX_HEIGHT);
+    
+    // The framebuffer is mapped write-combining: drain the WC buffers so
+    // the whole frame reaches the card now (locked op, no SSE needed)
+    __asm__ volatile("lock; orl $0, (%%esp)" : : : "memory");
 }
 
 void gfx_hline(int16_t x, int16_t y, int16_t width, uint8_t color) {
@@ -0,0 +1,55 @@
+/*
+ * KaiOS - Serial Port Driver
+ * Polled COM1 output, 38400 baud 8N1
+ */
+
+#include "include/drivers/serial.h"
+#include "include/drivers/io.h"
+
+static bool serial_present = false;
+
+void serial_init(void) {
+    uint16_t port = SERIAL_COM1;
+
+    outb(port + SERIAL_INT_ENABLE, 0x00);       // Polled, no interrupts
+    outb(port + SERIAL_LINE_CONTROL, 0x80);     // DLAB on: set divisor
+    outb(port + SERIAL_DATA, SERIAL_BAUD_DIVISOR & 0xFF);
+    outb(port + SERIAL_INT_ENABLE, SERIAL_BAUD_DIVISOR >> 8);
+    outb(port + SERIAL_LINE_CONTROL, 0x03);     // 8 data bits, no parity, 1 stop
+    outb(port + SERIAL_FIFO_CONTROL, 0xC7);     // Enable and clear FIFOs
+
+    // Loopback self-test: a missing UART reads back 0xFF
+    outb(port + SERIAL_MODEM_CONTROL, 0x1E);
+    outb(port + SERIAL_DATA, 0xAE);
+    if (inb(port + SERIAL_DATA) != 0xAE) {
+        serial_present = false;
+        return;
+    }
+
+    outb(port + SERIAL_MODEM_CONTROL, 0x0F);    // Normal operation
+    serial_present = true;
+}
+
+bool serial_is_present(void) {
+    return serial_present;
+}
+
+void serial_putchar(char c) {
+    if (!serial_present) {
+        return;
+    }
+
+    // Bounded wait so a wedged UART cannot hang the kernel
+    int timeout = 100000;
+    while (!(inb(SERIAL_COM1 + SERIAL_LINE_STATUS) & SERIAL_LSR_THR_EMPTY) && timeout--);
+    outb(SERIAL_COM1 + SERIAL_DATA, (uint8_t)c);
+}
+
+void serial_write(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') {
+            serial_putchar('\r');
+        }
+        serial_putchar(data[i]);
+    }
+}
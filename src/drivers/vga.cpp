@@ -82,7 +82,8 @@ void vga_scroll(void) {
     }
 }
 
-void vga_putchar(char c) {
+// Place one character without touching the hardware cursor
+static void put_char(char c) {
     if (c == '\n') {
         vga_column = 0;
         if (++vga_row == VGA_HEIGHT) {
@@ -115,21 +116,28 @@ void vga_putchar(char c) {
             }
         }
     }
+}
+
+void vga_putchar(char c) {
+    put_char(c);
     vga_set_cursor(vga_column, vga_row);
 }
 
+// Bulk writes move the hardware cursor once, at the end
 void vga_write(const char* data, size_t size) {
     for (size_t i = 0; i < size; i++) {
-        vga_putchar(data[i]);
+        put_char(data[i]);
     }
+    vga_set_cursor(vga_column, vga_row);
 }
 
 void vga_writestring(const char* data) {
     size_t i = 0;
     while (data[i] != '\0') {
-        vga_putchar(data[i]);
+        put_char(data[i]);
         i++;
     }
+    vga_set_cursor(vga_column, vga_row);
 }
 
 size_t vga_get_row(void) {
@@ -0,0 +1,152 @@
+/*
+ * KaiOS - Arena Allocator Implementation
+ * Bump-pointer allocation for short-lived scratch memory
+ *
+ * Chunks form a stack, newest on top. Allocation bumps the top chunk and
+ * pushes a new one when it is full; releasing to a mark pops every chunk
+ * pushed since and rewinds the one the mark points into.
+ */
+
+#include "include/kernel/arena.h"
+#include "include/kernel/memory.h"
+#include "include/kernel/pmm.h"
+#include "include/kernel/string.h"
+
+#define CHUNK_HEADER_SIZE ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static inline uint8_t* chunk_data(arena_chunk_t* chunk) {
+    return (uint8_t*)chunk + CHUNK_HEADER_SIZE;
+}
+
+static arena_chunk_t* chunk_create(size_t bytes) {
+    uint32_t order = pmm_order_for_size(bytes);
+    uintptr_t addr = pmm_alloc_pages(order);
+    if (addr == 0 && memory_reclaim((size_t)PMM_PAGE_SIZE << order) > 0) {
+        addr = pmm_alloc_pages(order);
+    }
+    if (addr == 0) {
+        return NULL;
+    }
+
+    arena_chunk_t* chunk = (arena_chunk_t*)addr;
+    chunk->prev = NULL;
+    chunk->order = order;
+    chunk->size = ((size_t)PMM_PAGE_SIZE << order) - CHUNK_HEADER_SIZE;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void chunk_destroy(arena_chunk_t* chunk) {
+    pmm_free_pages((uintptr_t)chunk, chunk->order);
+}
+
+// Pop the top chunk
+static void pop_chunk(arena_t* arena) {
+    arena_chunk_t* chunk = arena->current;
+    arena->current = chunk->prev;
+    chunk_destroy(chunk);
+}
+
+// ============================================================================
+// Setup
+// ============================================================================
+
+void arena_init(arena_t* arena, size_t chunk_size) {
+    arena->current = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+    arena->peak = 0;
+    arena->live = 0;
+}
+
+void arena_destroy(arena_t* arena) {
+    while (arena->current != NULL) {
+        pop_chunk(arena);
+    }
+    arena->live = 0;
+}
+
+// ============================================================================
+// Allocation
+// ============================================================================
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) {
+        size = ARENA_ALIGN;
+    }
+
+    arena_chunk_t* chunk = arena->current;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        // Oversized requests get a chunk of their own
+        size_t bytes = size + CHUNK_HEADER_SIZE;
+        chunk = chunk_create(bytes > arena->chunk_size ? bytes : arena->chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->prev = arena->current;
+        arena->current = chunk;
+    }
+
+    void* ptr = chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+
+    arena->live += size;
+    if (arena->live > arena->peak) {
+        arena->peak = arena->live;
+    }
+    return ptr;
+}
+
+void* arena_calloc(arena_t* arena, size_t size) {
+    void* ptr = arena_alloc(arena, size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+// ============================================================================
+// Scoped release
+// ============================================================================
+
+arena_mark_t arena_mark(arena_t* arena) {
+    arena_mark_t mark;
+    mark.chunk = arena->current;
+    mark.used = arena->current ? arena->current->used : 0;
+    mark.live = arena->live;
+    return mark;
+}
+
+void arena_release(arena_t* arena, arena_mark_t mark) {
+    while (arena->current != NULL && arena->current != mark.chunk) {
+        pop_chunk(arena);
+    }
+    if (arena->current != NULL) {
+        arena->current->used = mark.used;
+    }
+    arena->live = mark.live;
+}
+
+void arena_reset(arena_t* arena) {
+    // Keep one regular-sized chunk, free everything else
+    uint32_t regular = pmm_order_for_size(arena->chunk_size);
+    arena_chunk_t* keep = NULL;
+
+    while (arena->current != NULL) {
+        arena_chunk_t* chunk = arena->current;
+        arena->current = chunk->prev;
+
+        if (keep == NULL && chunk->order <= regular) {
+            keep = chunk;
+        } else {
+            chunk_destroy(chunk);
+        }
+    }
+
+    if (keep != NULL) {
+        keep->prev = NULL;
+        keep->used = 0;
+    }
+    arena->current = keep;
+    arena->live = 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * KaiOS - CPU Feature Detection
+ * Reads the CPUID vendor string and feature flags once at boot
+ */
+
+#include "include/kernel/cpu.h"
+#include "include/kernel/string.h"
+
+#define EFLAGS_ID (1U << 21)
+
+static uint32_t features = 0;
+static bool sse_enabled = false;
+static char vendor[13] = "unknown";
+
+// CPUID exists if the ID flag in EFLAGS can be toggled
+static bool cpuid_supported(void) {
+    uint32_t before, after;
+    __asm__ volatile(
+        "pushfl\n\t"
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl %2, %1\n\t"
+        "pushl %1\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %1\n\t"
+        "popfl"
+        : "=&r"(before), "=&r"(after)
+        : "i"(EFLAGS_ID));
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
+
+// Let kernel code execute SSE instructions: no x87 emulation, no lazy-FPU
+// trap, and fxsave/SIMD exception support announced in CR4
+static void enable_sse(void) {
+    if (!cpu_has_feature(CPU_FEATURE_FXSR | CPU_FEATURE_SSE)) {
+        return;
+    }
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP;
+    write_cr0(cr0);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    __asm__ volatile("fninit");
+
+    sse_enabled = true;
+
+    // Large memcpy/memset switch to 16-byte vector moves
+    string_use_sse2(cpu_has_feature(CPU_FEATURE_SSE2));
+}
+
+void cpu_init(void) {
+    if (!cpuid_supported()) {
+        return;
+    }
+
+    uint32_t max_leaf, ebx, ecx, edx;
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = '\0';
+
+    if (max_leaf >= 1) {
+        uint32_t eax;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        features = edx;
+    }
+
+    enable_sse();
+}
+
+bool cpu_has_feature(uint32_t feature) {
+    return (features & feature) == feature;
+}
+
+bool cpu_sse_enabled(void) {
+    return sse_enabled;
+}
+
+const char* cpu_vendor(void) {
+    return vendor;
+}
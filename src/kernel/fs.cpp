@@ -5,6 +5,7 @@
 
 #include "include/kernel/fs.h"
 #include "include/kernel/memory.h"
+#include "include/kernel/slab.h"
 #include "include/kernel/string.h"
 #include "include/drivers/ata.h"
 
@@ -12,6 +13,13 @@
 static fs_node_t* root_dir = NULL;
 static fs_node_t* current_dir = NULL;
 
+// Open file table
+static fs_file_t open_files[FS_MAX_OPEN];
+
+// Object caches for the two node layouts
+static slab_cache_t* file_cache = NULL;
+static slab_cache_t* dir_cache = NULL;
+
 // Simple tick counter for timestamps
 static uint32_t fs_time = 0;
 
@@ -19,561 +27,2544 @@ static uint32_t get_time(void) {
     return ++fs_time;
 }
 
-void fs_init(void) {
-    // Create root directory
-    root_dir = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-    if (root_dir == NULL) return;
-    
-    memset(root_dir, 0, sizeof(fs_node_t));
-    strcpy(root_dir->name, "/");
-    root_dir->type = FS_DIRECTORY;
-    root_dir->parent = root_dir;  // Root's parent is itself
-    root_dir->child_count = 0;
-    root_dir->created = get_time();
-    root_dir->modified = root_dir->created;
-    
-    current_dir = root_dir;
-    
-    // Create some default directories
-    fs_mkdir("bin");
-    fs_mkdir("etc");
-    fs_mkdir("home");
-    fs_mkdir("tmp");
-    
-    // Change to home directory
-    fs_chdir("home");
-    fs_mkdir("user");
-    fs_chdir("/");
-}
-
-fs_node_t* fs_get_root(void) {
-    return root_dir;
+static inline fs_file_node_t* as_file(fs_node_t* node) {
+    return (fs_file_node_t*)node;
 }
 
-fs_node_t* fs_get_current(void) {
-    return current_dir;
+static inline fs_dir_node_t* as_dir(fs_node_t* node) {
+    return (fs_dir_node_t*)node;
 }
 
-void fs_set_current(fs_node_t* node) {
-    if (node != NULL && node->type == FS_DIRECTORY) {
-        current_dir = node;
-    }
+static inline char* inline_name(fs_node_t* node) {
+    return node->type == FS_DIRECTORY ? as_dir(node)->inline_name : as_file(node)->inline_name;
 }
 
-// Find child by name in a directory
-static fs_node_t* find_child(fs_node_t* dir, const char* name) {
-    if (dir == NULL || name == NULL || dir->type != FS_DIRECTORY) {
-        return NULL;
-    }
-    
-    for (size_t i = 0; i < dir->child_count; i++) {
-        if (strcmp(dir->children[i]->name, name) == 0) {
-            return dir->children[i];
+// Allocate a zeroed node of the given type, not yet named
+static fs_node_t* node_alloc(uint8_t type) {
+    fs_node_t* node;
+    if (type == FS_DIRECTORY) {
+        if (dir_cache == NULL) {
+            dir_cache = slab_cache_create("fs_dir", sizeof(fs_dir_node_t), 0);
+        }
+        node = (fs_node_t*)slab_alloc(dir_cache);
+        if (node) memset(node, 0, sizeof(fs_dir_node_t));
+    } else {
+        if (file_cache == NULL) {
+            file_cache = slab_cache_create("fs_file", sizeof(fs_file_node_t), 0);
         }
+        node = (fs_node_t*)slab_alloc(file_cache);
+        if (node) memset(node, 0, sizeof(fs_file_node_t));
     }
     
-    return NULL;
+    if (node != NULL) {
+        node->type = type;
+        node->created = get_time();
+        node->modified = node->created;
+    }
+    return node;
 }
 
-fs_node_t* fs_resolve_path(const char* path) {
-    if (path == NULL || *path == '\0') {
-        return current_dir;
+static void node_free(fs_node_t* node) {
+    if (node->name != NULL && node->name != inline_name(node)) {
+        kfree(node->name);
     }
-    
-    fs_node_t* node;
-    char path_copy[FS_MAX_PATH];
-    char* token;
-    char* rest;
-    
-    strncpy(path_copy, path, FS_MAX_PATH - 1);
-    path_copy[FS_MAX_PATH - 1] = '\0';
-    
-    // Absolute or relative path
-    if (path_copy[0] == '/') {
-        node = root_dir;
-        rest = path_copy + 1;
+    slab_free(node->type == FS_DIRECTORY ? dir_cache : file_cache, node);
+}
+
+static void data_free(fs_file_node_t* file);
+static void slot_release(fs_node_t* node);
+static void run_free(uint32_t start, uint32_t length);
+static size_t fs_shrink(size_t bytes);
+
+// Release a node with its data and directory tables
+static void node_destroy(fs_node_t* node) {
+    slot_release(node);
+    if (node->type == FS_DIRECTORY) {
+        fs_dir_node_t* dir = as_dir(node);
+        if (dir->children) kfree(dir->children);
+        if (dir->index) kfree(dir->index);
+        if (dir->path) kfree(dir->path);
     } else {
-        node = current_dir;
-        rest = path_copy;
+        data_free(as_file(node));
     }
-    
-    // Parse path components
-    token = rest;
-    while (*token != '\0') {
-        // Find next separator
-        char* sep = strchr(token, '/');
-        if (sep != NULL) {
-            *sep = '\0';
-        }
-        
-        if (strlen(token) > 0) {
-            if (strcmp(token, ".") == 0) {
-                // Current directory - do nothing
-            } else if (strcmp(token, "..") == 0) {
-                // Parent directory
-                node = node->parent;
-            } else {
-                // Find child
-                fs_node_t* child = find_child(node, token);
-                if (child == NULL) {
-                    return NULL;  // Path not found
-                }
-                node = child;
-            }
+    node_free(node);
+}
+
+// Free a node and everything below it. Children are detached as they are
+// visited, so the walk needs no stack however deep the tree is.
+static void free_tree(fs_node_t* top) {
+    fs_node_t* node = top;
+    while (node != NULL) {
+        if (node->type == FS_DIRECTORY && as_dir(node)->child_count > 0) {
+            fs_dir_node_t* dir = as_dir(node);
+            node = dir->children[--dir->child_count];
+            continue;
         }
         
-        if (sep != NULL) {
-            token = sep + 1;
-        } else {
-            break;
-        }
+        fs_node_t* parent = (node == top) ? NULL : node->parent;
+        node_destroy(node);
+        node = parent;
     }
-    
-    return node;
 }
 
-int fs_get_path(fs_node_t* node, char* buffer, size_t size) {
-    if (node == NULL || buffer == NULL || size == 0) {
-        return -1;
+// ============================================================================
+// Dirty tracking
+// ============================================================================
+
+// Every saved node keeps one slot of the on-disk entry table for as long
+// as it exists, so a change rewrites just the table sector holding it.
+// The table grows with the tree and freed slots are handed out again first.
+#define DISK_ENTRY_SIZE     128
+#define ENTRIES_PER_SECTOR  (ATA_SECTOR_SIZE / DISK_ENTRY_SIZE)
+#define SLOTS_INITIAL       128
+
+// dirty_to of data that has never been written out
+#define DATA_ALL            ((size_t)-1)
+
+static fs_node_t** slots = NULL;        // NULL for a free slot
+static uint32_t* free_slots = NULL;     // Stack of free slots below slot_count
+static uint8_t* table_dirty = NULL;     // Per table sector
+static uint32_t slot_count = 0;         // Length of the table
+static uint32_t slot_capacity = 0;
+static uint32_t free_count = 0;
+
+// Whether the disk holds this tree, so that a save may skip what is clean
+static bool image_valid = false;
+
+static void mark_dirty(fs_node_t* node) {
+    if (node->slot != 0) {
+        table_dirty[(node->slot - 1) / ENTRIES_PER_SECTOR] = true;
     }
-    
-    if (node == root_dir) {
-        if (size < 2) return -1;
-        buffer[0] = '/';
-        buffer[1] = '\0';
-        return 0;
+}
+
+static bool slots_grow(uint32_t count) {
+    if (count <= slot_capacity) {
+        return true;
     }
     
-    // Build path from node to root
-    char temp[FS_MAX_PATH];
-    char* parts[64];
-    int count = 0;
+    uint32_t capacity = slot_capacity ? slot_capacity * 2 : SLOTS_INITIAL;
+    while (capacity < count) {
+        capacity *= 2;
+    }
     
-    fs_node_t* current = node;
-    while (current != root_dir && count < 64) {
-        parts[count++] = current->name;
-        current = current->parent;
+    fs_node_t** new_slots = (fs_node_t**)krealloc(slots, capacity * sizeof(fs_node_t*));
+    if (new_slots == NULL) {
+        return false;
     }
+    slots = new_slots;
     
-    // Construct path
-    buffer[0] = '\0';
-    for (int i = count - 1; i >= 0; i--) {
-        strcat(buffer, "/");
-        strcat(buffer, parts[i]);
+    uint32_t* new_free = (uint32_t*)krealloc(free_slots, capacity * sizeof(uint32_t));
+    if (new_free == NULL) {
+        return false;
     }
+    free_slots = new_free;
     
-    if (buffer[0] == '\0') {
-        strcpy(buffer, "/");
+    uint8_t* new_dirty = (uint8_t*)krealloc(table_dirty, capacity / ENTRIES_PER_SECTOR);
+    if (new_dirty == NULL) {
+        return false;
     }
+    table_dirty = new_dirty;
     
-    return 0;
+    memset(slots + slot_capacity, 0, (capacity - slot_capacity) * sizeof(fs_node_t*));
+    memset(table_dirty + slot_capacity / ENTRIES_PER_SECTOR, 0,
+           (capacity - slot_capacity) / ENTRIES_PER_SECTOR);
+    slot_capacity = capacity;
+    return true;
 }
 
-fs_node_t* fs_mkdir(const char* name) {
-    if (name == NULL || strlen(name) == 0 || strlen(name) >= FS_MAX_NAME) {
-        return NULL;
+// Forget the image: the next save writes everything
+static void slots_reset(void) {
+    if (slot_capacity > 0) {
+        memset(slots, 0, slot_capacity * sizeof(fs_node_t*));
+        memset(table_dirty, 0, slot_capacity / ENTRIES_PER_SECTOR);
     }
-    
-    if (strchr(name, '/') != NULL) {
-        return NULL;  // No slashes in name
+    slot_count = 0;
+    free_count = 0;
+    image_valid = false;
+}
+
+// Give a linked node a slot. A node that cannot get one (out of memory),
+// and everything below it, lives in memory only.
+static void slot_assign(fs_node_t* node) {
+    if (node->parent != node && node->parent->slot == 0) {
+        return;
     }
     
-    if (current_dir->child_count >= FS_MAX_CHILDREN) {
-        return NULL;  // Directory full
+    uint32_t i;
+    if (free_count > 0) {
+        i = free_slots[--free_count];
+    } else {
+        if (!slots_grow(slot_count + 1)) {
+            return;
+        }
+        i = slot_count++;
     }
     
-    if (find_child(current_dir, name) != NULL) {
-        return NULL;  // Already exists
+    slots[i] = node;
+    node->slot = i + 1;
+    mark_dirty(node);
+}
+
+static void slot_release(fs_node_t* node) {
+    if (node->slot != 0) {
+        mark_dirty(node);
+        slots[node->slot - 1] = NULL;
+        free_slots[free_count++] = node->slot - 1;
+        node->slot = 0;
     }
-    
-    fs_node_t* dir = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-    if (dir == NULL) return NULL;
-    
-    memset(dir, 0, sizeof(fs_node_t));
-    strcpy(dir->name, name);
-    dir->type = FS_DIRECTORY;
-    dir->parent = current_dir;
-    dir->child_count = 0;
-    dir->created = get_time();
-    dir->modified = dir->created;
-    
-    current_dir->children[current_dir->child_count++] = dir;
-    current_dir->modified = get_time();
-    
-    return dir;
 }
 
-int fs_rmdir(const char* name) {
-    fs_node_t* dir = find_child(current_dir, name);
-    
-    if (dir == NULL || dir->type != FS_DIRECTORY) {
-        return -1;
+// ============================================================================
+// Directory tables
+// ============================================================================
+
+#define DIR_INITIAL_CAPACITY  8
+
+// FNV-1a
+#define NAME_HASH_SEED   2166136261U
+#define NAME_HASH_PRIME  16777619U
+
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = NAME_HASH_SEED;
+    while (*name != '\0') {
+        hash ^= (uint8_t)*name++;
+        hash *= NAME_HASH_PRIME;
     }
-    
-    if (dir->child_count > 0) {
-        return -2;  // Directory not empty
+    return hash;
+}
+
+// Short names go in the node, longer ones on the heap
+static bool set_name(fs_node_t* node, const char* name) {
+    size_t len = strlen(name);
+    char* buffer = inline_name(node);
+    if (len >= FS_INLINE_NAME) {
+        buffer = (char*)kmalloc(len + 1);
+        if (buffer == NULL) {
+            return false;
+        }
     }
     
-    // Remove from parent's children
-    for (size_t i = 0; i < current_dir->child_count; i++) {
-        if (current_dir->children[i] == dir) {
-            // Shift remaining children
-            for (size_t j = i; j < current_dir->child_count - 1; j++) {
-                current_dir->children[j] = current_dir->children[j + 1];
-            }
-            current_dir->child_count--;
+    if (node->name != NULL && node->name != inline_name(node)) {
+        kfree(node->name);
+    }
+    memcpy(buffer, name, len + 1);
+    node->name = buffer;
+    node->name_hash = hash_name(name);
+    return true;
+}
+
+static void index_insert(fs_dir_node_t* dir, fs_node_t* child) {
+    size_t mask = dir->index_capacity - 1;
+    size_t slot = child->name_hash & mask;
+    while (dir->index[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    dir->index[slot] = child;
+}
+
+// Remove with backward-shift deletion, so no tombstones accumulate
+static void index_remove(fs_dir_node_t* dir, fs_node_t* child) {
+    size_t mask = dir->index_capacity - 1;
+    size_t slot = child->name_hash & mask;
+    while (dir->index[slot] != child) {
+        slot = (slot + 1) & mask;
+    }
+
+    size_t hole = slot;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        fs_node_t* entry = dir->index[slot];
+        if (entry == NULL) {
             break;
         }
+
+        // Move the entry back if its home slot does not lie between the
+        // hole and its current position (cyclically)
+        size_t home = entry->name_hash & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            dir->index[hole] = entry;
+            hole = slot;
+        }
     }
-    
-    kfree(dir);
-    current_dir->modified = get_time();
-    return 0;
+    dir->index[hole] = NULL;
 }
 
-int fs_chdir(const char* path) {
-    fs_node_t* node = fs_resolve_path(path);
-    
-    if (node == NULL || node->type != FS_DIRECTORY) {
-        return -1;
+// Keep the table at most half full
+static bool index_reserve(fs_dir_node_t* dir, size_t count) {
+    if (count * 2 <= dir->index_capacity) {
+        return true;
+    }
+
+    size_t capacity = dir->index_capacity ? dir->index_capacity * 2 : DIR_INITIAL_CAPACITY * 2;
+    while (count * 2 > capacity) {
+        capacity *= 2;
+    }
+
+    fs_node_t** index = (fs_node_t**)kcalloc(capacity, sizeof(fs_node_t*));
+    if (index == NULL) {
+        return false;
+    }
+
+    if (dir->index) kfree(dir->index);
+    dir->index = index;
+    dir->index_capacity = capacity;
+    for (size_t i = 0; i < dir->child_count; i++) {
+        index_insert(dir, dir->children[i]);
+    }
+    return true;
+}
+
+static bool dir_add_child(fs_dir_node_t* dir, fs_node_t* child) {
+    if (dir->child_count == dir->child_capacity) {
+        size_t capacity = dir->child_capacity ? dir->child_capacity * 2 : DIR_INITIAL_CAPACITY;
+        fs_node_t** children = (fs_node_t**)krealloc(dir->children, capacity * sizeof(fs_node_t*));
+        if (children == NULL) {
+            return false;
+        }
+        dir->children = children;
+        dir->child_capacity = capacity;
+    }
+
+    if (!index_reserve(dir, dir->child_count + 1)) {
+        return false;
+    }
+
+    dir->children[dir->child_count++] = child;
+    index_insert(dir, child);
+    child->parent = &dir->node;
+    return true;
+}
+
+static void dir_remove_child(fs_dir_node_t* dir, fs_node_t* child) {
+    index_remove(dir, child);
+
+    for (size_t i = 0; i < dir->child_count; i++) {
+        if (dir->children[i] == child) {
+            memmove(&dir->children[i], &dir->children[i + 1],
+                    (dir->child_count - i - 1) * sizeof(fs_node_t*));
+            dir->child_count--;
+            break;
+        }
+    }
+}
+
+// ============================================================================
+// File data
+// ============================================================================
+
+#define TAIL_MIN_CAPACITY  32
+
+static slab_cache_t* data_cache = NULL;
+
+static size_t extents_for(size_t size) {
+    return (size + FS_EXTENT_SIZE - 1) >> FS_EXTENT_SHIFT;
+}
+
+// Smallest tail size (doubling from start) that holds bytes
+static size_t tail_size_for(size_t start, size_t bytes) {
+    size_t capacity = start < TAIL_MIN_CAPACITY ? TAIL_MIN_CAPACITY : start;
+    while (capacity < bytes) {
+        capacity *= 2;
+    }
+    return capacity < FS_EXTENT_SIZE ? capacity : FS_EXTENT_SIZE;
+}
+
+static fs_data_t* data_create(void) {
+    if (data_cache == NULL) {
+        data_cache = slab_cache_create("fs_data", sizeof(fs_data_t), 0);
+    }
+    fs_data_t* data = (fs_data_t*)slab_alloc(data_cache);
+    if (data != NULL) {
+        memset(data, 0, sizeof(fs_data_t));
+        data->refcount = 1;
+        data->dirty_to = DATA_ALL;
+    }
+    return data;
+}
+
+static void data_release(fs_data_t* data) {
+    if (data == NULL || --data->refcount > 0) {
+        return;
+    }
+    run_free(data->disk_sector, data->disk_sectors);
+    for (size_t i = 0; i < data->extent_count; i++) {
+        kfree(data->extents[i]);
+    }
+    if (data->extents) kfree(data->extents);
+    slab_free(data_cache, data);
+}
+
+static inline bool data_inline(fs_file_node_t* file) {
+    return (file->node.flags & FS_NODE_INLINE) != 0;
+}
+
+static void data_free(fs_file_node_t* file) {
+    if (data_inline(file)) {
+        file->node.flags &= ~FS_NODE_INLINE;
+    } else {
+        data_release(file->data);
+    }
+    file->data = NULL;
+}
+
+static bool data_shared(fs_file_node_t* file) {
+    return !data_inline(file) && file->data != NULL && file->data->refcount > 1;
+}
+
+// Address of the byte at offset, which must be within the allocated data
+static inline uint8_t* data_at(fs_file_node_t* file, size_t offset) {
+    if (data_inline(file)) {
+        return file->inline_data + offset;
+    }
+    return file->data->extents[offset >> FS_EXTENT_SHIFT] + (offset & (FS_EXTENT_SIZE - 1));
+}
+
+// Drop all extents past the first count. The data must not be shared.
+static void data_trim(fs_file_node_t* file, size_t count) {
+    if (count == 0) {
+        data_free(file);
+        return;
     }
     
-    current_dir = node;
-    return 0;
+    fs_data_t* data = file->data;
+    if (data_inline(file) || data == NULL) {
+        return;
+    }
+    while (data->extent_count > count) {
+        kfree(data->extents[--data->extent_count]);
+        data->tail_capacity = FS_EXTENT_SIZE;
+    }
 }
 
-fs_node_t** fs_readdir(fs_node_t* dir, size_t* count) {
-    if (dir == NULL || dir->type != FS_DIRECTORY) {
-        *count = 0;
-        return NULL;
+static bool data_unshare(fs_file_node_t* file);
+static bool extents_reserve(fs_data_t* data, size_t size);
+static bool data_fetch(fs_file_node_t* file);
+
+// While nonzero, code is working on extents across an allocation and
+// fs_shrink must leave every file alone
+static uint32_t data_pins = 0;
+
+// Note a change of len bytes at offset for the next save
+static inline void data_touch(fs_file_node_t* file, size_t offset, size_t len) {
+    if (data_inline(file)) {
+        return;
     }
     
-    *count = dir->child_count;
-    return dir->children;
+    fs_data_t* data = file->data;
+    if (data->dirty_from >= data->dirty_to) {
+        data->dirty_from = offset;
+        data->dirty_to = offset + len;
+    } else {
+        if (offset < data->dirty_from) data->dirty_from = offset;
+        if (offset + len > data->dirty_to) data->dirty_to = offset + len;
+    }
 }
 
-fs_node_t* fs_create(const char* name) {
-    if (name == NULL || strlen(name) == 0 || strlen(name) >= FS_MAX_NAME) {
-        return NULL;
+// Make sure size bytes of data fit, fetching and unsharing first. On failure the
+// contents are intact and whatever was allocated stays as spare capacity.
+static bool data_reserve(fs_file_node_t* file, size_t size) {
+    size_t needed = extents_for(size);
+    if (needed == 0) {
+        return true;
     }
     
-    if (strchr(name, '/') != NULL) {
-        return NULL;
+    if (!data_unshare(file)) {
+        return false;
     }
     
-    if (current_dir->child_count >= FS_MAX_CHILDREN) {
-        return NULL;
+    // Tiny files with no extents yet stay inside the node
+    bool in_node = data_inline(file);
+    if (in_node || file->data == NULL) {
+        if (size <= FS_INLINE_DATA) {
+            file->node.flags |= FS_NODE_INLINE;
+            return true;
+        }
+        
+        fs_data_t* data = data_create();
+        if (data == NULL) {
+            return false;
+        }
+        file->node.flags &= ~FS_NODE_INLINE;
+        
+        // Move inline contents out once the first extent exists
+        uint8_t saved[FS_INLINE_DATA];
+        if (in_node) {
+            memcpy(saved, file->inline_data, file->node.size);
+        }
+        file->data = data;
+        if (!data_reserve(file, size)) {
+            data_release(data);
+            file->data = NULL;
+            if (in_node) {
+                file->node.flags |= FS_NODE_INLINE;
+                memcpy(file->inline_data, saved, file->node.size);
+            }
+            return false;
+        }
+        if (in_node) {
+            memcpy(data->extents[0], saved, file->node.size);
+        }
+        return true;
     }
     
-    if (find_child(current_dir, name) != NULL) {
-        return NULL;  // Already exists
+    data_pins++;
+    bool ok = extents_reserve(file->data, size);
+    data_pins--;
+    return ok;
+}
+
+// Allocate extents for size bytes of data
+static bool extents_reserve(fs_data_t* data, size_t size) {
+    size_t needed = extents_for(size);
+    if (needed == 0) {
+        return true;
     }
     
-    fs_node_t* file = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-    if (file == NULL) return NULL;
+    if (needed > data->extent_slots) {
+        size_t slots = data->extent_slots ? data->extent_slots * 2 : 4;
+        while (slots < needed) {
+            slots *= 2;
+        }
+        uint8_t** extents = (uint8_t**)krealloc(data->extents, slots * sizeof(uint8_t*));
+        if (extents == NULL) {
+            return false;
+        }
+        data->extents = extents;
+        data->extent_slots = slots;
+    }
     
-    memset(file, 0, sizeof(fs_node_t));
-    strcpy(file->name, name);
-    file->type = FS_FILE;
-    file->parent = current_dir;
-    file->size = 0;
-    file->data = NULL;
-    file->created = get_time();
-    file->modified = file->created;
+    // Bytes that will live in the last extent
+    size_t tail_bytes = size - ((needed - 1) << FS_EXTENT_SHIFT);
+    
+    // Grow the current tail, to full size if extents will follow it
+    if (data->extent_count > 0 && data->tail_capacity < FS_EXTENT_SIZE) {
+        size_t want = needed > data->extent_count ? FS_EXTENT_SIZE : tail_bytes;
+        if (want > data->tail_capacity) {
+            size_t capacity = tail_size_for(data->tail_capacity * 2, want);
+            uint8_t** tail = &data->extents[data->extent_count - 1];
+            uint8_t* extent = (uint8_t*)krealloc(*tail, capacity);
+            if (extent == NULL) {
+                return false;
+            }
+            *tail = extent;
+            data->tail_capacity = capacity;
+        }
+    }
     
-    current_dir->children[current_dir->child_count++] = file;
-    current_dir->modified = get_time();
+    while (data->extent_count < needed) {
+        size_t want = data->extent_count + 1 < needed ? FS_EXTENT_SIZE : tail_bytes;
+        size_t capacity = tail_size_for(0, want);
+        uint8_t* extent = (uint8_t*)kmalloc(capacity);
+        if (extent == NULL) {
+            return false;
+        }
+        data->extents[data->extent_count++] = extent;
+        data->tail_capacity = capacity;
+    }
     
-    return file;
+    return true;
+}
+
+// Get a file's data ready to be modified: in memory, and its own copy
+// rather than shared
+static bool data_unshare(fs_file_node_t* file) {
+    if (!data_fetch(file)) {
+        return false;
+    }
+    if (!data_shared(file)) {
+        return true;
+    }
+    
+    data_pins++;
+    fs_data_t* shared = file->data;
+    file->data = data_create();
+    if (file->data == NULL || !data_reserve(file, file->node.size)) {
+        data_release(file->data);
+        file->data = shared;
+        data_pins--;
+        return false;
+    }
+    
+    // Only the extents holding file bytes; the shared data may carry spare
+    // ones past the end left by a failed reserve
+    size_t count = extents_for(file->node.size);
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i << FS_EXTENT_SHIFT;
+        size_t chunk = file->node.size - offset;
+        if (chunk > FS_EXTENT_SIZE) chunk = FS_EXTENT_SIZE;
+        memcpy(file->data->extents[i], shared->extents[i], chunk);
+    }
+    shared->refcount--;
+    data_pins--;
+    return true;
+}
+
+// Copy into reserved, unshared space at offset
+static void data_copy_in(fs_file_node_t* file, size_t offset, const uint8_t* src, size_t len) {
+    if (len > 0) {
+        data_touch(file, offset, len);
+    }
+    while (len > 0) {
+        size_t chunk = FS_EXTENT_SIZE - (offset & (FS_EXTENT_SIZE - 1));
+        if (chunk > len) chunk = len;
+        
+        memcpy(data_at(file, offset), src, chunk);
+        offset += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+}
+
+static void data_zero(fs_file_node_t* file, size_t offset, size_t len) {
+    if (len > 0) {
+        data_touch(file, offset, len);
+    }
+    while (len > 0) {
+        size_t chunk = FS_EXTENT_SIZE - (offset & (FS_EXTENT_SIZE - 1));
+        if (chunk > len) chunk = len;
+        
+        memset(data_at(file, offset), 0, chunk);
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+static void data_copy_out(fs_file_node_t* file, size_t offset, uint8_t* dst, size_t len) {
+    while (len > 0) {
+        size_t chunk = FS_EXTENT_SIZE - (offset & (FS_EXTENT_SIZE - 1));
+        if (chunk > len) chunk = len;
+        
+        memcpy(dst, data_at(file, offset), chunk);
+        offset += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+}
+
+void fs_init(void) {
+    static bool shrinker_registered = false;
+    if (!shrinker_registered) {
+        shrinker_registered = memory_register_shrinker("fs", fs_shrink, FS_SHRINKER_PRIORITY);
+    }
+    
+    slots_reset();
+    
+    // Create root directory
+    root_dir = node_alloc(FS_DIRECTORY);
+    if (root_dir == NULL) return;
+    
+    set_name(root_dir, "/");
+    root_dir->parent = root_dir;  // Root's parent is itself
+    slot_assign(root_dir);
+    
+    current_dir = root_dir;
+    
+    // Create some default directories
+    fs_mkdir("bin");
+    fs_mkdir("etc");
+    fs_mkdir("home");
+    fs_mkdir("tmp");
+    
+    // Change to home directory
+    fs_chdir("home");
+    fs_mkdir("user");
+    fs_chdir("/");
+}
+
+fs_node_t* fs_get_root(void) {
+    return root_dir;
+}
+
+fs_node_t* fs_get_current(void) {
+    return current_dir;
+}
+
+void fs_set_current(fs_node_t* node) {
+    if (node != NULL && node->type == FS_DIRECTORY) {
+        current_dir = node;
+    }
+}
+
+// Find a child by name (len bytes, not necessarily terminated) and its hash
+static fs_node_t* lookup_child(fs_node_t* node, const char* name, size_t len, uint32_t hash) {
+    if (node->type != FS_DIRECTORY || len >= FS_MAX_NAME) {
+        return NULL;
+    }
+    
+    fs_dir_node_t* dir = as_dir(node);
+    if (dir->index_capacity == 0) {
+        return NULL;
+    }
+    
+    size_t mask = dir->index_capacity - 1;
+    for (size_t slot = hash & mask; dir->index[slot] != NULL; slot = (slot + 1) & mask) {
+        fs_node_t* child = dir->index[slot];
+        if (child->name_hash == hash && memcmp(child->name, name, len) == 0 &&
+            child->name[len] == '\0') {
+            return child;
+        }
+    }
+    
+    return NULL;
+}
+
+// Find child by name in a directory
+static fs_node_t* find_child(fs_node_t* dir, const char* name) {
+    if (dir == NULL || name == NULL) {
+        return NULL;
+    }
+    return lookup_child(dir, name, strlen(name), hash_name(name));
+}
+
+fs_node_t* fs_resolve_path(const char* path) {
+    if (path == NULL || *path == '\0') {
+        return current_dir;
+    }
+    
+    // Absolute or relative path
+    fs_node_t* node = current_dir;
+    if (*path == '/') {
+        node = root_dir;
+        path++;
+    }
+    
+    // Walk the components in place, hashing each one as its end is found,
+    // so every directory costs a single index probe
+    while (*path != '\0') {
+        const char* start = path;
+        uint32_t hash = NAME_HASH_SEED;
+        while (*path != '\0' && *path != '/') {
+            hash ^= (uint8_t)*path++;
+            hash *= NAME_HASH_PRIME;
+        }
+        size_t len = path - start;
+        if (*path == '/') {
+            path++;
+        }
+        
+        if (len == 0 || (len == 1 && start[0] == '.')) {
+            // Empty component or current directory - do nothing
+        } else if (len == 2 && start[0] == '.' && start[1] == '.') {
+            // Parent directory
+            node = node->parent;
+        } else {
+            node = lookup_child(node, start, len, hash);
+            if (node == NULL) {
+                return NULL;  // Path not found
+            }
+        }
+    }
+    
+    return node;
+}
+
+// ============================================================================
+// Path cache
+// ============================================================================
+
+// Directories cache their canonical path on first use. Renaming a
+// directory changes the path of everything below it, so instead of walking
+// the subtree it bumps the generation and every cached path goes stale.
+static uint32_t path_generation = 1;
+
+static bool path_valid(fs_node_t* node) {
+    if (node->type != FS_DIRECTORY) {
+        return false;
+    }
+    fs_dir_node_t* dir = as_dir(node);
+    return dir->path != NULL && dir->path_gen == path_generation;
+}
+
+// Cache path (len bytes) on a directory; failure just means no caching
+static void path_store(fs_dir_node_t* dir, const char* path, size_t len) {
+    if (dir->path == NULL || dir->path_len < len) {
+        if (dir->path) kfree(dir->path);
+        dir->path = (char*)kmalloc(len + 1);
+        if (dir->path == NULL) {
+            return;
+        }
+    }
+    memcpy(dir->path, path, len);
+    dir->path[len] = '\0';
+    dir->path_len = len;
+    dir->path_gen = path_generation;
+}
+
+int fs_get_path(fs_node_t* node, char* buffer, size_t size) {
+    if (node == NULL || buffer == NULL || size == 0) {
+        return -1;
+    }
+    
+    // Build the path right to left in a scratch buffer, stopping at the
+    // first ancestor whose path is already known
+    char temp[FS_MAX_PATH];
+    size_t start = FS_MAX_PATH;
+    fs_node_t* current = node;
+    bool truncated = false;
+    
+    while (current != root_dir && !path_valid(current)) {
+        size_t len = strlen(current->name);
+        if (len + 1 > start) {
+            truncated = true;
+            break;
+        }
+        start -= len;
+        memcpy(temp + start, current->name, len);
+        temp[--start] = '/';
+        current = current->parent;
+    }
+    
+    size_t prefix = 0;
+    if (!truncated && current != root_dir) {
+        prefix = as_dir(current)->path_len;
+        if (prefix > start) {
+            truncated = true;
+        }
+    }
+    
+    size_t tail = FS_MAX_PATH - start;
+    if (truncated) {
+        // Deeper than FS_MAX_PATH: keep the end, the part a user cares about
+        prefix = 0;
+        if (tail > size - 1) {
+            start += tail - (size - 1);
+            tail = size - 1;
+        }
+    }
+    size_t total = prefix + tail;
+    if (total == 0) {
+        // Root
+        temp[--start] = '/';
+        tail = total = 1;
+    }
+    
+    // Cache the result if the node is a directory with a complete path
+    if (!truncated && node->type == FS_DIRECTORY && node != root_dir && !path_valid(node)) {
+        if (prefix > 0) {
+            memcpy(temp + start - prefix, as_dir(current)->path, prefix);
+            start -= prefix;
+            tail += prefix;
+            prefix = 0;
+        }
+        path_store(as_dir(node), temp + start, tail);
+    }
+    
+    // Copy out: cached prefix, then the part built here
+    size_t copied = 0;
+    if (prefix > 0) {
+        copied = prefix < size - 1 ? prefix : size - 1;
+        memcpy(buffer, as_dir(current)->path, copied);
+    }
+    size_t rest = tail < size - 1 - copied ? tail : size - 1 - copied;
+    memcpy(buffer + copied, temp + start, rest);
+    buffer[copied + rest] = '\0';
+    
+    return (truncated || copied + rest < total) ? -1 : 0;
+}
+
+fs_node_t* fs_mkdir(const char* name) {
+    if (name == NULL || strlen(name) == 0 || strlen(name) >= FS_MAX_NAME) {
+        return NULL;
+    }
+    
+    if (strchr(name, '/') != NULL) {
+        return NULL;  // No slashes in name
+    }
+    
+    if (find_child(current_dir, name) != NULL) {
+        return NULL;  // Already exists
+    }
+    
+    fs_node_t* dir = node_alloc(FS_DIRECTORY);
+    if (dir == NULL) return NULL;
+    
+    if (!set_name(dir, name) || !dir_add_child(as_dir(current_dir), dir)) {
+        node_free(dir);
+        return NULL;
+    }
+    slot_assign(dir);
+    current_dir->modified = get_time();
+    
+    return dir;
+}
+
+int fs_rmdir(const char* name) {
+    fs_node_t* dir = find_child(current_dir, name);
+    
+    if (dir == NULL || dir->type != FS_DIRECTORY) {
+        return -1;
+    }
+    
+    if (as_dir(dir)->child_count > 0) {
+        return -2;  // Directory not empty
+    }
+    
+    dir_remove_child(as_dir(current_dir), dir);
+    node_destroy(dir);
+    current_dir->modified = get_time();
+    return 0;
+}
+
+int fs_chdir(const char* path) {
+    fs_node_t* node = fs_resolve_path(path);
+    
+    if (node == NULL || node->type != FS_DIRECTORY) {
+        return -1;
+    }
+    
+    current_dir = node;
+    return 0;
+}
+
+fs_node_t** fs_readdir(fs_node_t* dir, size_t* count) {
+    if (dir == NULL || dir->type != FS_DIRECTORY) {
+        *count = 0;
+        return NULL;
+    }
+    
+    *count = as_dir(dir)->child_count;
+    return as_dir(dir)->children;
+}
+
+static fs_node_t* create_file(fs_node_t* dir, const char* name) {
+    if (name == NULL || strlen(name) == 0 || strlen(name) >= FS_MAX_NAME) {
+        return NULL;
+    }
+    
+    if (strchr(name, '/') != NULL) {
+        return NULL;
+    }
+    
+    if (find_child(dir, name) != NULL) {
+        return NULL;  // Already exists
+    }
+    
+    fs_node_t* file = node_alloc(FS_FILE);
+    if (file == NULL) return NULL;
+    
+    if (!set_name(file, name) || !dir_add_child(as_dir(dir), file)) {
+        node_free(file);
+        return NULL;
+    }
+    slot_assign(file);
+    dir->modified = get_time();
+    
+    return file;
+}
+
+fs_node_t* fs_create(const char* name) {
+    return create_file(current_dir, name);
+}
+
+static bool node_is_open(fs_node_t* node) {
+    for (size_t i = 0; i < FS_MAX_OPEN; i++) {
+        if (open_files[i].node == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int fs_delete(const char* name) {
+    fs_node_t* file = find_child(current_dir, name);
+    
+    if (file == NULL) {
+        return -1;
+    }
+    
+    if (file->type == FS_DIRECTORY && as_dir(file)->child_count > 0) {
+        return -2;  // Can't delete non-empty directory
+    }
+    
+    if (node_is_open(file)) {
+        return -3;  // Busy
+    }
+    
+    dir_remove_child(as_dir(current_dir), file);
+    node_destroy(file);
+    current_dir->modified = get_time();
+    
+    return 0;
+}
+
+int fs_write(fs_node_t* node, const void* data, size_t size) {
+    if (node == NULL || node->type != FS_FILE) {
+        return -1;
+    }
+    fs_file_node_t* file = as_file(node);
+    
+    // Shared contents are simply let go, as are extents when the new
+    // contents fit in the node; otherwise reuse the extents still covered
+    if (data_shared(file) || size <= FS_INLINE_DATA) {
+        data_free(file);
+    }
+    data_trim(file, extents_for(size));
+    node->size = 0;
+    if (!data_reserve(file, size)) {
+        data_free(file);
+        mark_dirty(node);
+        return -3;
+    }
+    
+    data_copy_in(file, 0, (const uint8_t*)data, size);
+    node->size = size;
+    node->modified = get_time();
+    mark_dirty(node);
+    return 0;
+}
+
+int fs_append(fs_node_t* node, const void* data, size_t size) {
+    if (node == NULL || node->type != FS_FILE) {
+        return -1;
+    }
+    
+    if (size == 0) {
+        return 0;
+    }
+    
+    fs_file_node_t* file = as_file(node);
+    if (!data_reserve(file, node->size + size)) {
+        return -3;
+    }
+    
+    data_copy_in(file, node->size, (const uint8_t*)data, size);
+    node->size += size;
+    node->modified = get_time();
+    mark_dirty(node);
+    
+    return 0;
+}
+
+int fs_read(fs_node_t* file, void* buffer, size_t size, size_t offset) {
+    if (file == NULL || file->type != FS_FILE || buffer == NULL) {
+        return -1;
+    }
+    
+    if (offset >= file->size) {
+        return 0;  // Nothing to read
+    }
+    
+    if (!data_fetch(as_file(file))) {
+        return -3;
+    }
+    
+    size_t bytes_to_read = size;
+    if (size > file->size - offset) {
+        bytes_to_read = file->size - offset;
+    }
+    
+    data_copy_out(as_file(file), offset, (uint8_t*)buffer, bytes_to_read);
+    return bytes_to_read;
+}
+
+fs_node_t* fs_find(const char* name) {
+    return find_child(current_dir, name);
+}
+
+int fs_rename(const char* old_name, const char* new_name) {
+    if (new_name == NULL || strlen(new_name) == 0 || strlen(new_name) >= FS_MAX_NAME) {
+        return -1;
+    }
+    
+    fs_node_t* node = find_child(current_dir, old_name);
+    if (node == NULL) {
+        return -2;
+    }
+    
+    if (find_child(current_dir, new_name) != NULL) {
+        return -3;  // New name already exists
+    }
+    
+    // The name hash changes, so re-slot the node; listing order is kept
+    fs_dir_node_t* dir = as_dir(current_dir);
+    index_remove(dir, node);
+    bool renamed = set_name(node, new_name);
+    index_insert(dir, node);
+    if (!renamed) {
+        return -4;
+    }
+    node->modified = get_time();
+    mark_dirty(node);
+    
+    if (node->type == FS_DIRECTORY) {
+        path_generation++;
+    }
+    
+    return 0;
+}
+
+int fs_copy(const char* src, const char* dest) {
+    fs_node_t* src_file = find_child(current_dir, src);
+    if (src_file == NULL || src_file->type != FS_FILE) {
+        return -1;
+    }
+    
+    fs_node_t* dest_file = fs_create(dest);
+    if (dest_file == NULL) {
+        return -2;
+    }
+    
+    // Share the data; the first write to either file separates them.
+    // Inline contents are just copied.
+    fs_file_node_t* src_node = as_file(src_file);
+    fs_file_node_t* dest_node = as_file(dest_file);
+    if (data_inline(src_node)) {
+        memcpy(dest_node->inline_data, src_node->inline_data, FS_INLINE_DATA);
+        dest_file->flags |= FS_NODE_INLINE;
+    } else if (src_node->data != NULL) {
+        src_node->data->refcount++;
+        dest_node->data = src_node->data;
+    }
+    dest_file->size = src_file->size;
+    
+    return 0;
+}
+
+// ============================================================================
+// Open files
+// ============================================================================
+
+// Create the file a path names inside an existing directory
+static fs_node_t* create_path(const char* path) {
+    const char* name = strrchr(path, '/');
+    if (name == NULL) {
+        return create_file(current_dir, path);
+    }
+    name++;
+    
+    size_t len = name - path;
+    if (len >= FS_MAX_PATH) {
+        return NULL;
+    }
+    
+    char parent_path[FS_MAX_PATH];
+    memcpy(parent_path, path, len);
+    parent_path[len] = '\0';
+    
+    fs_node_t* dir = fs_resolve_path(parent_path);
+    if (dir == NULL || dir->type != FS_DIRECTORY) {
+        return NULL;
+    }
+    return create_file(dir, name);
+}
+
+fs_file_t* fs_open(const char* path, int flags) {
+    if (path == NULL || (flags & (FS_O_READ | FS_O_WRITE)) == 0) {
+        return NULL;
+    }
+    
+    fs_file_t* file = NULL;
+    for (size_t i = 0; i < FS_MAX_OPEN; i++) {
+        if (open_files[i].node == NULL) {
+            file = &open_files[i];
+            break;
+        }
+    }
+    if (file == NULL) {
+        return NULL;  // Too many open files
+    }
+    
+    fs_node_t* node = fs_resolve_path(path);
+    if (node == NULL && (flags & FS_O_CREATE)) {
+        node = create_path(path);
+    }
+    if (node == NULL || node->type != FS_FILE) {
+        return NULL;
+    }
+    
+    if ((flags & FS_O_TRUNC) && (flags & FS_O_WRITE) && node->size > 0) {
+        data_free(as_file(node));
+        node->size = 0;
+        node->modified = get_time();
+        mark_dirty(node);
+    }
+    
+    file->node = node;
+    file->offset = 0;
+    file->flags = flags;
+    return file;
+}
+
+void fs_close(fs_file_t* file) {
+    if (file != NULL) {
+        file->node = NULL;
+    }
+}
+
+int fs_file_read(fs_file_t* file, void* buffer, size_t size) {
+    if (file == NULL || file->node == NULL || !(file->flags & FS_O_READ)) {
+        return -1;
+    }
+    
+    int bytes = fs_read(file->node, buffer, size, file->offset);
+    if (bytes > 0) {
+        file->offset += bytes;
+    }
+    return bytes;
+}
+
+int fs_file_write(fs_file_t* file, const void* data, size_t size) {
+    if (file == NULL || file->node == NULL || !(file->flags & FS_O_WRITE)) {
+        return -1;
+    }
+    
+    fs_node_t* node = file->node;
+    fs_file_node_t* contents = as_file(node);
+    if (file->flags & FS_O_APPEND) {
+        file->offset = node->size;
+    }
+    
+    size_t end = file->offset + size;
+    if (end < file->offset) {
+        return -2;
+    }
+    
+    if (!data_unshare(contents)) {
+        return -3;
+    }
+    
+    if (end > node->size) {
+        if (!data_reserve(contents, end)) {
+            return -3;
+        }
+        // Writing past the end leaves a zero-filled gap
+        if (file->offset > node->size) {
+            data_zero(contents, node->size, file->offset - node->size);
+        }
+    }
+    
+    data_copy_in(contents, file->offset, (const uint8_t*)data, size);
+    if (end > node->size) {
+        node->size = end;
+    }
+    node->modified = get_time();
+    mark_dirty(node);
+    file->offset = end;
+    
+    return size;
+}
+
+int fs_seek(fs_file_t* file, int offset, int whence) {
+    if (file == NULL || file->node == NULL) {
+        return -1;
+    }
+    
+    size_t base;
+    switch (whence) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = file->offset; break;
+        case FS_SEEK_END: base = file->node->size; break;
+        default: return -1;
+    }
+    
+    if (offset < 0 && (size_t)-offset > base) {
+        return -1;
+    }
+    
+    file->offset = base + offset;
+    return file->offset;
+}
+
+const uint8_t* fs_view(fs_file_t* file, size_t* length) {
+    *length = 0;
+    if (file == NULL || file->node == NULL || !(file->flags & FS_O_READ)) {
+        return NULL;
+    }
+    
+    fs_node_t* node = file->node;
+    if (file->offset >= node->size || !data_fetch(as_file(node))) {
+        return NULL;
+    }
+    
+    size_t chunk = FS_EXTENT_SIZE - (file->offset & (FS_EXTENT_SIZE - 1));
+    if (chunk > node->size - file->offset) {
+        chunk = node->size - file->offset;
+    }
+    
+    const uint8_t* view = data_at(as_file(node), file->offset);
+    file->offset += chunk;
+    *length = chunk;
+    return view;
+}
+
+// ============================================================================
+// Disk Persistence
+// ============================================================================
+
+// From FS_START_SECTOR the image holds a header sector, the journal and
+// then runs of sectors: one for the entry table (one slot per node, see
+// slot_assign), one for the free-space bitmap and one per file of more
+// than FS_INLINE_DATA bytes. Runs are reserved with room to grow and
+// rewritten in place. A run that is outgrown grows into the free sectors
+// after it if it can, and otherwise moves on its own to the best-fitting
+// free gap; the sectors it leaves are reused.
+//
+// A save is one transaction. Sectors the committed image does not use
+// (new runs, or the space a full save lays a new image out in) are
+// written directly; everything else, the header included, is appended to
+// the journal and only copied to its home sector by a checkpoint. fs_load
+// replays what was committed, so a crash at any point leaves the image as
+// of either the previous save or the interrupted one.
+
+#define FS_MAGIC        0x4B414946  // "KAIF" - KaiOS File System
+#define FS_VERSION      5
+#define FS_START_SECTOR 100         // Start saving at sector 100
+#define JOURNAL_START   (FS_START_SECTOR + 1)
+#define JOURNAL_SECTORS 256
+#define DATA_START      (JOURNAL_START + JOURNAL_SECTORS)
+
+// Table sectors per disk transfer
+#define TABLE_BATCH     32
+
+// On-disk file entry structure (DISK_ENTRY_SIZE bytes, free slots are zero)
+typedef struct {
+    char name[FS_MAX_NAME];
+    uint8_t type;           // 0 = file, 1 = directory
+    uint8_t reserved[3];
+    uint32_t size;          // File size
+    uint32_t parent;        // Slot of the parent directory
+    uint32_t data_sector;   // Run holding the data, 0 if inline
+    uint32_t data_sectors;  // Sectors reserved for the run
+    uint8_t inline_data[FS_INLINE_DATA];
+    uint8_t padding[DISK_ENTRY_SIZE - FS_MAX_NAME - 20 - FS_INLINE_DATA];
+} PACKED disk_entry_t;
+
+// On-disk header
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;       // Table slots
+    uint32_t next_data_sector;  // End of the image
+    uint32_t table_sector;      // Run holding the entry table
+    uint32_t table_sectors;
+    uint32_t bitmap_sector;     // Run holding the free-space bitmap
+    uint32_t bitmap_sectors;
+    uint32_t journal_tail;      // First transaction not checkpointed
+    uint32_t journal_sequence;  // and its sequence number
+} PACKED disk_header_t;
+
+static bool disk_available = false;
+static uint32_t next_data_sector = DATA_START;
+static uint32_t table_sector = 0;
+static uint32_t table_sectors = 0;
+static uint32_t bitmap_sector = 0;
+static uint32_t bitmap_sectors = 0;
+
+// The header as of the last commit
+static disk_header_t committed;
+static bool image_on_disk = false;
+
+// Bumped by every fs_save; data remembers the pass that moved its run
+static uint32_t save_pass = 0;
+static uint32_t save_sectors = 0;
+
+bool fs_has_disk(void) {
+    return disk_available && ata_is_present();
+}
+
+uint32_t fs_last_save_sectors(void) {
+    return save_sectors;
+}
+
+static bool disk_write_direct(uint32_t lba, uint32_t count, const void* buffer) {
+    save_sectors += count;
+    return ata_write_sectors(lba, count, buffer);
+}
+
+// ----------------------------------------------------------------------------
+// Space allocation
+// ----------------------------------------------------------------------------
+
+// Sectors from DATA_START up to next_data_sector are handed out in runs,
+// tracked with one bit per sector in three maps:
+//   space_used   in use by the tree in memory; saved as the image's bitmap
+//   space_saved  in use by the committed image
+//   space_held   not to be handed out: in use by the committed image, or
+//                freed since the last checkpoint, as a journaled write
+//                may still be on its way there
+// A run is allocated only where neither used nor held is set, which also
+// means it can be written directly (see disk_write).
+#define SPACE_BITS_PER_SECTOR   (ATA_SECTOR_SIZE * 8)
+
+static uint32_t* space_used = NULL;
+static uint32_t* space_saved = NULL;
+static uint32_t* space_held = NULL;
+static uint8_t* space_dirty = NULL;         // Per bitmap sector
+static uint32_t space_capacity = 0;         // Bits in each map
+static uint32_t alloc_hint = DATA_START;    // Just past the last run allocated
+
+static inline uint32_t space_sectors_for(uint32_t end) {
+    return (end - DATA_START + SPACE_BITS_PER_SECTOR - 1) / SPACE_BITS_PER_SECTOR;
+}
+
+static inline bool space_test(const uint32_t* map, uint32_t sector) {
+    uint32_t bit = sector - DATA_START;
+    return sector >= DATA_START && bit < space_capacity && (map[bit / 32] & (1U << (bit % 32)));
+}
+
+// Make the maps cover the image up to end
+static bool space_grow(uint32_t end) {
+    uint32_t bits = end - DATA_START;
+    if (bits <= space_capacity) {
+        return true;
+    }
+    
+    uint32_t capacity = space_capacity ? space_capacity * 2 : SPACE_BITS_PER_SECTOR;
+    while (capacity < bits) {
+        capacity *= 2;
+    }
+    
+    uint32_t** maps[3] = { &space_used, &space_saved, &space_held };
+    for (int i = 0; i < 3; i++) {
+        uint32_t* map = (uint32_t*)krealloc(*maps[i], capacity / 8);
+        if (map == NULL) {
+            return false;
+        }
+        memset((uint8_t*)map + space_capacity / 8, 0, (capacity - space_capacity) / 8);
+        *maps[i] = map;
+    }
+    
+    uint8_t* dirty = (uint8_t*)krealloc(space_dirty, capacity / SPACE_BITS_PER_SECTOR);
+    if (dirty == NULL) {
+        return false;
+    }
+    memset(dirty + space_capacity / SPACE_BITS_PER_SECTOR, 0,
+           (capacity - space_capacity) / SPACE_BITS_PER_SECTOR);
+    space_dirty = dirty;
+    space_capacity = capacity;
+    return true;
+}
+
+// Set or clear length bits of a map from start
+static void space_set(uint32_t* map, uint32_t start, uint32_t length, bool value) {
+    for (uint32_t bit = start - DATA_START; length > 0; bit++, length--) {
+        if (value) {
+            map[bit / 32] |= 1U << (bit % 32);
+        } else {
+            map[bit / 32] &= ~(1U << (bit % 32));
+        }
+    }
+}
+
+static void space_mark(uint32_t start, uint32_t length, bool used) {
+    if (length == 0) {
+        return;
+    }
+    space_set(space_used, start, length, used);
+    uint32_t first = (start - DATA_START) / SPACE_BITS_PER_SECTOR;
+    uint32_t last = (start + length - 1 - DATA_START) / SPACE_BITS_PER_SECTOR;
+    memset(space_dirty + first, true, last - first + 1);
+}
+
+// First sector from from on, below end, that is busy (used or held) or,
+// with busy false, free
+static uint32_t space_find(uint32_t from, uint32_t end, bool busy) {
+    while (from < end) {
+        uint32_t bit = from - DATA_START;
+        uint32_t word = space_used[bit / 32] | space_held[bit / 32];
+        if (!busy) {
+            word = ~word;
+        }
+        word &= ~0U << (bit % 32);
+        if (word != 0) {
+            uint32_t found = from - bit % 32 + __builtin_ctz(word);
+            return found < end ? found : end;
+        }
+        from += 32 - bit % 32;
+    }
+    return end;
+}
+
+// Allocate a run of length sectors: the smallest free gap that fits, the
+// one nearest hint among equals, or else at the end of the image. Returns
+// 0 when out of memory.
+static uint32_t run_alloc(uint32_t length, uint32_t hint) {
+    uint32_t best = 0;
+    uint32_t best_size = 0;
+    uint32_t best_distance = 0;
+    uint32_t tail = next_data_sector;       // Start of a free gap at the end
+    
+    uint32_t sector = space_find(DATA_START, next_data_sector, false);
+    while (sector < next_data_sector) {
+        uint32_t gap_end = space_find(sector, next_data_sector, true);
+        uint32_t size = gap_end - sector;
+        uint32_t distance = sector > hint ? sector - hint : hint - sector;
+        if (gap_end == next_data_sector) {
+            tail = sector;
+        }
+        if (size >= length && (best == 0 || size < best_size ||
+                               (size == best_size && distance < best_distance))) {
+            best = sector;
+            best_size = size;
+            best_distance = distance;
+            if (size == length && distance == 0) {
+                break;
+            }
+        }
+        sector = space_find(gap_end, next_data_sector, false);
+    }
+    
+    if (best == 0) {
+        best = tail;
+        if (!space_grow(best + length)) {
+            return 0;
+        }
+        if (best + length > next_data_sector) {
+            next_data_sector = best + length;
+        }
+    }
+    
+    space_mark(best, length, true);
+    alloc_hint = best + length;
+    return best;
+}
+
+static void run_free(uint32_t start, uint32_t length) {
+    if (start != 0) {
+        space_mark(start, length, false);
+    }
+}
+
+// Grow a run to length sectors where it is, if the sectors after it are free
+static bool run_extend(uint32_t start, uint32_t old_length, uint32_t length) {
+    uint32_t end = start + length;
+    uint32_t limit = end < next_data_sector ? end : next_data_sector;
+    if (space_find(start + old_length, limit, true) < limit || !space_grow(end)) {
+        return false;
+    }
+    
+    if (end > next_data_sector) {
+        next_data_sector = end;
+    }
+    space_mark(start + old_length, length - old_length, true);
+    return true;
+}
+
+// The save has committed: its runs are the committed image, and stay held
+// along with whatever it freed until the next checkpoint
+static void space_commit(void) {
+    for (uint32_t w = 0; w < space_capacity / 32; w++) {
+        space_saved[w] = space_used[w];
+        space_held[w] |= space_used[w];
+    }
+}
+
+// The journal is empty: nothing but the committed image needs holding
+static void space_release(void) {
+    memcpy(space_held, space_saved, space_capacity / 8);
+}
+
+// ----------------------------------------------------------------------------
+// Journal
+// ----------------------------------------------------------------------------
+
+// A transaction is one or more descriptors, each followed by the sectors
+// it lists, and a commit block with the CRC-32 of all of them. The
+// journal is circular; records of earlier rounds fail the sequence check.
+#define JOURNAL_MAGIC       0x4B41494A  // "KAIJ"
+#define JOURNAL_DESCRIPTOR  1
+#define JOURNAL_COMMIT      2
+#define JOURNAL_TAGS        ((ATA_SECTOR_SIZE - 20) / 4)
+
+// Sectors one transaction may journal, leaving room for its descriptors
+// and commit block
+#define JOURNAL_MAX_BLOCKS  (JOURNAL_SECTORS - 8)
+
+// A rewrite of more sectors than this moves the run instead of going
+// through the journal
+#define JOURNAL_RELOCATE    32
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t sequence;
+    uint32_t count;             // Sectors following a descriptor
+    uint32_t checksum;          // Commit: CRC-32 of the transaction
+    uint32_t lba[JOURNAL_TAGS]; // Home sector of each
+} PACKED journal_block_t;
+
+static uint32_t journal_head = 0;       // Where the next transaction goes
+static uint32_t journal_tail = 0;
+static uint32_t journal_sequence = 1;   // Of the next transaction
+static uint32_t tail_sequence = 1;
+
+// The transaction being built: home sector and contents of each sector
+static uint32_t* tx_lba = NULL;
+static uint8_t* tx_data = NULL;
+static uint32_t tx_count = 0;
+static uint32_t tx_capacity = 0;
+static bool tx_overflow = false;
+
+// CRC-32 (IEEE), bit at a time; chains across calls
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len) {
+    crc = ~crc;
+    while (len-- > 0) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static bool journal_read(uint32_t pos, void* buffer) {
+    return ata_read_sectors(JOURNAL_START + pos % JOURNAL_SECTORS, 1, buffer);
+}
+
+// Write count sectors at pos, wrapping around the end of the journal
+static bool journal_write(uint32_t pos, uint32_t count, const uint8_t* buffer) {
+    while (count > 0) {
+        pos %= JOURNAL_SECTORS;
+        uint32_t chunk = JOURNAL_SECTORS - pos;
+        if (chunk > count) chunk = count;
+        if (chunk > 255) chunk = 255;
+        if (!disk_write_direct(JOURNAL_START + pos, chunk, buffer)) {
+            return false;
+        }
+        pos += chunk;
+        buffer += chunk * ATA_SECTOR_SIZE;
+        count -= chunk;
+    }
+    return true;
+}
+
+static uint32_t journal_used(void) {
+    return (journal_head + JOURNAL_SECTORS - journal_tail) % JOURNAL_SECTORS;
+}
+
+// Check the transaction at pos. On success end is where the next begins.
+static bool journal_verify(uint32_t pos, uint32_t sequence, uint32_t* end) {
+    journal_block_t block;
+    uint8_t sector[ATA_SECTOR_SIZE];
+    uint32_t crc = 0;
+    uint32_t used = 0;
+    
+    for (;;) {
+        if (used >= JOURNAL_SECTORS || !journal_read(pos, &block) ||
+            block.magic != JOURNAL_MAGIC || block.sequence != sequence) {
+            return false;
+        }
+        
+        if (block.type == JOURNAL_COMMIT) {
+            *end = (pos + 1) % JOURNAL_SECTORS;
+            return used > 0 && block.checksum == crc;
+        }
+        if (block.type != JOURNAL_DESCRIPTOR || block.count == 0 || block.count > JOURNAL_TAGS) {
+            return false;
+        }
+        
+        crc = crc32_update(crc, (const uint8_t*)&block, ATA_SECTOR_SIZE);
+        for (uint32_t i = 1; i <= block.count; i++) {
+            if (!journal_read(pos + i, sector)) {
+                return false;
+            }
+            crc = crc32_update(crc, sector, ATA_SECTOR_SIZE);
+        }
+        pos = (pos + 1 + block.count) % JOURNAL_SECTORS;
+        used += 1 + block.count;
+    }
+}
+
+// Copy a verified transaction to its home sectors. The header is taken
+// into header instead, for the caller to write once.
+static bool journal_apply(uint32_t pos, disk_header_t* header) {
+    journal_block_t block;
+    uint8_t sector[ATA_SECTOR_SIZE];
+    
+    for (;;) {
+        if (!journal_read(pos, &block)) {
+            return false;
+        }
+        if (block.type == JOURNAL_COMMIT) {
+            return true;
+        }
+        
+        for (uint32_t i = 0; i < block.count; i++) {
+            if (!journal_read(pos + 1 + i, sector)) {
+                return false;
+            }
+            uint32_t lba = block.lba[i];
+            if (lba == FS_START_SECTOR) {
+                memcpy(header, sector, sizeof(disk_header_t));
+            } else if (lba >= DATA_START && !disk_write_direct(lba, 1, sector)) {
+                return false;
+            }
+        }
+        pos = (pos + 1 + block.count) % JOURNAL_SECTORS;
+    }
+}
+
+// Apply every committed transaction from the header's journal tail on
+// and move the tail past them
+static bool journal_replay(disk_header_t* header) {
+    uint32_t pos = header->journal_tail;
+    uint32_t sequence = header->journal_sequence;
+    uint32_t end;
+    
+    while (journal_verify(pos, sequence, &end)) {
+        if (!journal_apply(pos, header)) {
+            return false;
+        }
+        pos = end;
+        sequence++;
+    }
+    
+    header->journal_tail = pos;
+    header->journal_sequence = sequence;
+    return true;
+}
+
+static bool write_header(const disk_header_t* header) {
+    uint8_t sector_buf[ATA_SECTOR_SIZE];
+    memset(sector_buf, 0, sizeof(sector_buf));
+    memcpy(sector_buf, header, sizeof(disk_header_t));
+    return disk_write_direct(FS_START_SECTOR, 1, sector_buf);
+}
+
+// Bring the home sectors up to date and empty the journal
+static bool journal_checkpoint(void) {
+    if (journal_head == journal_tail) {
+        space_release();
+        return true;
+    }
+    
+    disk_header_t header = committed;
+    header.journal_tail = journal_tail;
+    header.journal_sequence = tail_sequence;
+    if (!journal_replay(&header) || !write_header(&header)) {
+        return false;
+    }
+    
+    journal_tail = header.journal_tail;
+    tail_sequence = header.journal_sequence;
+    committed.journal_tail = journal_tail;
+    committed.journal_sequence = tail_sequence;
+    space_release();
+    return true;
+}
+
+// Start an empty journal for a new image. Zeroing it keeps records left
+// by an earlier image from ever passing for this one's.
+static bool journal_reset(void) {
+    uint8_t* zero = (uint8_t*)kcalloc(TABLE_BATCH, ATA_SECTOR_SIZE);
+    if (zero == NULL) {
+        return false;
+    }
+    
+    bool ok = true;
+    for (uint32_t pos = 0; ok && pos < JOURNAL_SECTORS; pos += TABLE_BATCH) {
+        ok = journal_write(pos, TABLE_BATCH, zero);
+    }
+    kfree(zero);
+    
+    journal_head = journal_tail = 0;
+    journal_sequence = tail_sequence = 1;
+    return ok;
+}
+
+static void tx_reset(void) {
+    if (tx_lba) kfree(tx_lba);
+    if (tx_data) kfree(tx_data);
+    tx_lba = NULL;
+    tx_data = NULL;
+    tx_count = tx_capacity = 0;
+    tx_overflow = false;
+}
+
+// Add a sector to the transaction. Past JOURNAL_MAX_BLOCKS the
+// transaction is marked overflowing instead (see fs_save).
+static bool tx_add(uint32_t lba, const uint8_t* sector) {
+    if (tx_count == JOURNAL_MAX_BLOCKS) {
+        tx_overflow = true;
+        return true;
+    }
+    
+    if (tx_count == tx_capacity) {
+        uint32_t capacity = tx_capacity ? tx_capacity * 2 : 16;
+        if (capacity > JOURNAL_MAX_BLOCKS) capacity = JOURNAL_MAX_BLOCKS;
+        uint32_t* lbas = (uint32_t*)krealloc(tx_lba, capacity * sizeof(uint32_t));
+        if (lbas == NULL) {
+            return false;
+        }
+        tx_lba = lbas;
+        uint8_t* data = (uint8_t*)krealloc(tx_data, capacity * ATA_SECTOR_SIZE);
+        if (data == NULL) {
+            return false;
+        }
+        tx_data = data;
+        tx_capacity = capacity;
+    }
+    
+    tx_lba[tx_count] = lba;
+    memcpy(tx_data + tx_count * ATA_SECTOR_SIZE, sector, ATA_SECTOR_SIZE);
+    tx_count++;
+    return true;
+}
+
+// Append the transaction to the journal; it is durable once the commit
+// block is on disk
+static bool journal_append(void) {
+    if (tx_overflow) {
+        return false;
+    }
+    if (tx_count == 0) {
+        return true;
+    }
+    
+    uint32_t descriptors = (tx_count + JOURNAL_TAGS - 1) / JOURNAL_TAGS;
+    if (journal_used() + descriptors + tx_count + 1 >= JOURNAL_SECTORS && !journal_checkpoint()) {
+        return false;
+    }
+    
+    journal_block_t block;
+    uint32_t crc = 0;
+    uint32_t pos = journal_head;
+    for (uint32_t first = 0; first < tx_count; first += JOURNAL_TAGS) {
+        uint32_t count = tx_count - first < JOURNAL_TAGS ? tx_count - first : JOURNAL_TAGS;
+        const uint8_t* sectors = tx_data + first * ATA_SECTOR_SIZE;
+        
+        memset(&block, 0, sizeof(block));
+        block.magic = JOURNAL_MAGIC;
+        block.type = JOURNAL_DESCRIPTOR;
+        block.sequence = journal_sequence;
+        block.count = count;
+        memcpy(block.lba, tx_lba + first, count * sizeof(uint32_t));
+        
+        crc = crc32_update(crc, (const uint8_t*)&block, ATA_SECTOR_SIZE);
+        crc = crc32_update(crc, sectors, count * ATA_SECTOR_SIZE);
+        if (!journal_write(pos, 1, (const uint8_t*)&block) ||
+            !journal_write(pos + 1, count, sectors)) {
+            return false;
+        }
+        pos = (pos + 1 + count) % JOURNAL_SECTORS;
+    }
+    
+    memset(&block, 0, sizeof(block));
+    block.magic = JOURNAL_MAGIC;
+    block.type = JOURNAL_COMMIT;
+    block.sequence = journal_sequence;
+    block.checksum = crc;
+    if (!journal_write(pos, 1, (const uint8_t*)&block)) {
+        return false;
+    }
+    
+    journal_head = (pos + 1) % JOURNAL_SECTORS;
+    journal_sequence++;
+    return true;
+}
+
+// Whether the committed image may be using sector, or a journaled write
+// be headed for it
+static inline bool sector_live(uint32_t sector) {
+    return image_on_disk && space_test(space_held, sector);
+}
+
+// Write sectors of the image: directly where the committed image does not
+// use them, through the transaction where it does
+static bool disk_write(uint32_t lba, uint32_t count, const void* buffer) {
+    const uint8_t* src = (const uint8_t*)buffer;
+    
+    while (count > 0) {
+        bool live = sector_live(lba);
+        uint32_t run = 1;
+        while (run < count && sector_live(lba + run) == live) {
+            run++;
+        }
+        
+        if (live) {
+            for (uint32_t i = 0; i < run; i++) {
+                if (!tx_add(lba + i, src + i * ATA_SECTOR_SIZE)) {
+                    return false;
+                }
+            }
+        } else if (!disk_write_direct(lba, run, src)) {
+            return false;
+        }
+        
+        lba += run;
+        src += run * ATA_SECTOR_SIZE;
+        count -= run;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Image
+// ----------------------------------------------------------------------------
+
+static inline uint32_t table_sectors_for(uint32_t count) {
+    return (count + ENTRIES_PER_SECTOR - 1) / ENTRIES_PER_SECTOR;
+}
+
+static inline uint32_t sectors_for(size_t bytes) {
+    return (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE;
+}
+
+// Runs are reserved with room to grow: the next power of two while
+// small, then a quarter extra
+static uint32_t run_size_for(uint32_t sectors) {
+    if (sectors >= 256) {
+        return sectors + sectors / 4;
+    }
+    uint32_t run = 1;
+    while (run < sectors) {
+        run *= 2;
+    }
+    return run;
+}
+
+// Fit a run to sectors. It grows where it is if the sectors after it are
+// free, and otherwise moves to a new run; moved is then set, as the
+// contents have to be written in full. A run left far too big gives its
+// tail back.
+static bool run_place(uint32_t* start, uint32_t* length, uint32_t sectors, bool* moved) {
+    uint32_t run = run_size_for(sectors);
+    *moved = false;
+    
+    if (*start != 0 && sectors <= *length) {
+        if (run * 4 <= *length) {
+            run_free(*start + run, *length - run);
+            *length = run;
+        }
+        return true;
+    }
+    if (*start != 0 && run_extend(*start, *length, run)) {
+        *length = run;
+        return true;
+    }
+    
+    uint32_t at = run_alloc(run, alloc_hint);
+    if (at == 0) {
+        return false;
+    }
+    run_free(*start, *length);
+    *start = at;
+    *length = run;
+    *moved = true;
+    return true;
+}
+
+static inline fs_data_t* run_data(fs_node_t* node) {
+    if (node == NULL || node->type != FS_FILE || data_inline(as_file(node))) {
+        return NULL;
+    }
+    return as_file(node)->data;
 }
 
-int fs_delete(const char* name) {
-    fs_node_t* file = find_child(current_dir, name);
+// Make sure the data's run holds size bytes. A large rewrite of a run the
+// image uses moves it rather than filling the journal. Entries pointing at
+// a run that changed are rewritten (see save_data).
+static bool data_place(fs_data_t* data, size_t size) {
+    uint32_t sectors = sectors_for(size);
+    size_t to = data->dirty_to < size ? data->dirty_to : size;
+    uint32_t dirty = sectors_for(to) - data->dirty_from / ATA_SECTOR_SIZE;
+    uint32_t start = data->disk_sector;
+    uint32_t length = data->disk_sectors;
+    
+    if (start != 0 && sector_live(start) && dirty > JOURNAL_RELOCATE) {
+        run_free(start, length);
+        data->disk_sector = 0;
+        data->disk_sectors = 0;
+    }
     
-    if (file == NULL) {
-        return -1;
+    bool moved;
+    if (!run_place(&data->disk_sector, &data->disk_sectors, sectors, &moved)) {
+        return false;
+    }
+    if (moved) {
+        data->dirty_from = 0;
+        data->dirty_to = DATA_ALL;
+    }
+    if (data->disk_sector != start || data->disk_sectors != length) {
+        data->save_pass = save_pass;
+    }
+    return true;
+}
+
+// Place a table-like run whose sectors have dirty flags, moving it if
+// more of it changed than is worth journaling
+static bool meta_place(uint32_t* start, uint32_t* length, uint32_t sectors, uint8_t* dirty) {
+    uint32_t changed = 0;
+    for (uint32_t s = 0; s < sectors; s++) {
+        changed += dirty[s];
     }
     
-    if (file->type == FS_DIRECTORY && file->child_count > 0) {
-        return -2;  // Can't delete non-empty directory
+    if (*start != 0 && sector_live(*start) && changed > JOURNAL_RELOCATE) {
+        run_free(*start, *length);
+        *start = 0;
+        *length = 0;
     }
     
-    // Remove from parent's children
-    for (size_t i = 0; i < current_dir->child_count; i++) {
-        if (current_dir->children[i] == file) {
-            for (size_t j = i; j < current_dir->child_count - 1; j++) {
-                current_dir->children[j] = current_dir->children[j + 1];
-            }
-            current_dir->child_count--;
-            break;
+    bool moved;
+    if (!run_place(start, length, sectors, &moved)) {
+        return false;
+    }
+    if (moved) {
+        memset(dirty, true, sectors);
+    }
+    return true;
+}
+
+static bool table_place(void) {
+    return meta_place(&table_sector, &table_sectors, table_sectors_for(slot_count), table_dirty);
+}
+
+// The bitmap covers its own run, so placing it can grow the image and
+// with it the bitmap
+static bool bitmap_place(void) {
+    uint32_t sectors;
+    do {
+        sectors = space_sectors_for(next_data_sector);
+        if (!meta_place(&bitmap_sector, &bitmap_sectors, sectors, space_dirty)) {
+            return false;
         }
+    } while (space_sectors_for(next_data_sector) > bitmap_sectors);
+    return true;
+}
+
+// Write the sectors of a file's run that hold bytes from..to. Full sectors
+// go straight from the extents; only a trailing partial sector is bounced.
+static bool write_file_data(fs_file_node_t* file, uint32_t sector, size_t from, size_t to) {
+    uint8_t bounce[ATA_SECTOR_SIZE];
+    size_t size = file->node.size;
+    size_t first = from / ATA_SECTOR_SIZE;
+    size_t offset = first * ATA_SECTOR_SIZE;
+    sector += first;
+    
+    // Whole sectors, except that the last one stops at the end of the file
+    size_t end = size;
+    if (to < size) {
+        end = (to + ATA_SECTOR_SIZE - 1) & ~(size_t)(ATA_SECTOR_SIZE - 1);
+        if (end > size) end = size;
     }
     
-    if (file->data != NULL) {
-        kfree(file->data);
+    while (offset < end) {
+        size_t bytes = FS_EXTENT_SIZE - (offset & (FS_EXTENT_SIZE - 1));
+        if (bytes > end - offset) bytes = end - offset;
+        uint8_t* src = data_at(file, offset);
+        
+        size_t full = bytes / ATA_SECTOR_SIZE;
+        if (full > 0 && !disk_write(sector, full, src)) {
+            return false;
+        }
+        sector += full;
+        
+        size_t partial = bytes % ATA_SECTOR_SIZE;
+        if (partial > 0) {
+            memcpy(bounce, src + full * ATA_SECTOR_SIZE, partial);
+            memset(bounce + partial, 0, ATA_SECTOR_SIZE - partial);
+            if (!disk_write(sector, 1, bounce)) {
+                return false;
+            }
+            sector++;
+        }
+        offset += bytes;
     }
-    kfree(file);
-    current_dir->modified = get_time();
-    
-    return 0;
+    return true;
 }
 
-int fs_write(fs_node_t* file, const void* data, size_t size) {
-    if (file == NULL || file->type != FS_FILE) {
-        return -1;
+// Read evicted data back from its run. Nothing else touches the run
+// while the data is evicted, and eviction waits for the journal to be
+// checkpointed, so the home sectors are current.
+static bool data_fetch(fs_file_node_t* file) {
+    uint8_t bounce[ATA_SECTOR_SIZE];
+    
+    if (data_inline(file) || file->data == NULL || !file->data->evicted) {
+        return true;
     }
     
-    if (size > FS_MAX_FILE_SIZE) {
-        return -2;
+    fs_data_t* data = file->data;
+    size_t size = file->node.size;
+    if (!extents_reserve(data, size)) {
+        return false;
     }
     
-    // Free old data
-    if (file->data != NULL) {
-        kfree(file->data);
+    uint32_t sector = data->disk_sector;
+    for (size_t offset = 0; offset < size; offset += FS_EXTENT_SIZE) {
+        uint8_t* extent = data->extents[offset >> FS_EXTENT_SHIFT];
+        size_t bytes = size - offset;
+        if (bytes > FS_EXTENT_SIZE) bytes = FS_EXTENT_SIZE;
+        
+        size_t full = bytes / ATA_SECTOR_SIZE;
+        if (full > 0 && !ata_read_sectors(sector, full, extent)) {
+            return false;
+        }
+        sector += full;
+        
+        size_t partial = bytes % ATA_SECTOR_SIZE;
+        if (partial > 0) {
+            if (!ata_read_sectors(sector, 1, bounce)) {
+                return false;
+            }
+            memcpy(extent + full * ATA_SECTOR_SIZE, bounce, partial);
+            sector++;
+        }
     }
     
-    if (size == 0) {
-        file->data = NULL;
-        file->size = 0;
-    } else {
-        file->data = (uint8_t*)kmalloc(size);
-        if (file->data == NULL) {
-            return -3;
+    data->evicted = false;
+    return true;
+}
+
+// Whether an open file uses the data; fs_view hands out pointers into it
+static bool data_open(fs_data_t* data) {
+    for (size_t i = 0; i < FS_MAX_OPEN; i++) {
+        fs_node_t* node = open_files[i].node;
+        if (node != NULL && run_data(node) == data) {
+            return true;
         }
-        memcpy(file->data, data, size);
-        file->size = size;
     }
-    
-    file->modified = get_time();
-    return 0;
+    return false;
 }
 
-int fs_append(fs_node_t* file, const void* data, size_t size) {
-    if (file == NULL || file->type != FS_FILE) {
-        return -1;
+// Free the extents of clean data that is saved in its run
+static size_t data_evict(fs_data_t* data) {
+    if (data->evicted || data->extent_count == 0 || data->disk_sector == 0 ||
+        data->dirty_from < data->dirty_to || data_open(data)) {
+        return 0;
     }
     
-    if (file->size + size > FS_MAX_FILE_SIZE) {
-        return -2;
+    size_t released = data->extent_slots * sizeof(uint8_t*);
+    for (size_t i = 0; i < data->extent_count; i++) {
+        released += i + 1 < data->extent_count ? FS_EXTENT_SIZE : data->tail_capacity;
+        kfree(data->extents[i]);
     }
+    kfree(data->extents);
+    data->extents = NULL;
+    data->extent_count = 0;
+    data->extent_slots = 0;
+    data->tail_capacity = 0;
+    data->evicted = true;
+    return released;
+}
+
+// Memory-pressure shrinker: evict clean file data, going round the table
+// from where the last pass stopped
+static size_t fs_shrink(size_t bytes) {
+    static uint32_t cursor = 0;
     
-    if (size == 0) {
+    // Not during a save, nor while memory and disk differ
+    if (!image_valid || data_pins > 0 || slot_count == 0) {
         return 0;
     }
-    
-    uint8_t* new_data = (uint8_t*)kmalloc(file->size + size);
-    if (new_data == NULL) {
-        return -3;
+    if (journal_head != journal_tail && !journal_checkpoint()) {
+        return 0;
     }
     
-    if (file->data != NULL) {
-        memcpy(new_data, file->data, file->size);
-        kfree(file->data);
+    size_t released = 0;
+    for (uint32_t n = 0; n < slot_count && released < bytes; n++) {
+        cursor = cursor + 1 < slot_count ? cursor + 1 : 0;
+        fs_data_t* data = run_data(slots[cursor]);
+        if (data != NULL) {
+            released += data_evict(data);
+        }
     }
-    
-    memcpy(new_data + file->size, data, size);
-    file->data = new_data;
-    file->size += size;
-    file->modified = get_time();
-    
-    return 0;
+    return released;
 }
 
-int fs_read(fs_node_t* file, void* buffer, size_t size, size_t offset) {
-    if (file == NULL || file->type != FS_FILE || buffer == NULL) {
-        return -1;
-    }
-    
-    if (offset >= file->size) {
-        return 0;  // Nothing to read
+// Write the changed part of every file. A full save first forgets every
+// run, so the data is laid out afresh.
+static bool save_data(bool full) {
+    for (uint32_t i = 0; i < slot_count; i++) {
+        fs_data_t* data = run_data(slots[i]);
+        if (data == NULL) {
+            continue;
+        }
+        
+        // Copies sharing a run already placed in this pass are skipped.
+        // Evicted data has to be read back before its run is forgotten.
+        if (full && data->save_pass != save_pass) {
+            if (!data_fetch(as_file(slots[i]))) {
+                return false;
+            }
+            data->disk_sector = 0;
+            data->disk_sectors = 0;
+            data->dirty_from = 0;
+            data->dirty_to = DATA_ALL;
+        }
+        
+        fs_file_node_t* file = as_file(slots[i]);
+        if (data->dirty_from < data->dirty_to && data->dirty_from < file->node.size) {
+            if (!data_place(data, file->node.size) ||
+                !write_file_data(file, data->disk_sector, data->dirty_from, data->dirty_to)) {
+                return false;
+            }
+        }
+        data->dirty_from = data->dirty_to = 0;
     }
     
-    size_t bytes_to_read = size;
-    if (offset + size > file->size) {
-        bytes_to_read = file->size - offset;
+    // Entries of files whose run changed, including copies sharing it
+    for (uint32_t i = 0; i < slot_count; i++) {
+        fs_data_t* data = run_data(slots[i]);
+        if (data != NULL && data->save_pass == save_pass) {
+            mark_dirty(slots[i]);
+        }
     }
-    
-    memcpy(buffer, file->data + offset, bytes_to_read);
-    return bytes_to_read;
+    return true;
 }
 
-fs_node_t* fs_find(const char* name) {
-    return find_child(current_dir, name);
+static void fill_entry(fs_node_t* node, disk_entry_t* entry) {
+    strncpy(entry->name, node->name, FS_MAX_NAME - 1);
+    entry->type = (uint8_t)node->type;
+    entry->size = node->size;
+    entry->parent = node->parent->slot - 1;
+    
+    if (node->type == FS_FILE) {
+        fs_file_node_t* file = as_file(node);
+        fs_data_t* data = run_data(node);
+        if (data != NULL) {
+            entry->data_sector = data->disk_sector;
+            entry->data_sectors = data->disk_sectors;
+        } else if (data_inline(file)) {
+            memcpy(entry->inline_data, file->inline_data, node->size);
+        }
+    }
 }
 
-int fs_rename(const char* old_name, const char* new_name) {
-    if (new_name == NULL || strlen(new_name) == 0 || strlen(new_name) >= FS_MAX_NAME) {
-        return -1;
+// Write the table sectors holding changed entries, each stretch of
+// consecutive dirty sectors in as few transfers as possible
+static bool save_table(void) {
+    uint8_t* buffer = (uint8_t*)kmalloc(TABLE_BATCH * ATA_SECTOR_SIZE);
+    if (buffer == NULL) {
+        return false;
     }
     
-    fs_node_t* node = find_child(current_dir, old_name);
-    if (node == NULL) {
-        return -2;
+    uint32_t sectors = table_sectors_for(slot_count);
+    uint32_t s = 0;
+    bool ok = true;
+    while (ok && s < sectors) {
+        if (!table_dirty[s]) {
+            s++;
+            continue;
+        }
+        
+        uint32_t count = 0;
+        memset(buffer, 0, TABLE_BATCH * ATA_SECTOR_SIZE);
+        while (s + count < sectors && count < TABLE_BATCH && table_dirty[s + count]) {
+            uint32_t first = (s + count) * ENTRIES_PER_SECTOR;
+            for (uint32_t j = 0; j < ENTRIES_PER_SECTOR && first + j < slot_count; j++) {
+                if (slots[first + j] != NULL) {
+                    uint8_t* dst = buffer + count * ATA_SECTOR_SIZE + j * DISK_ENTRY_SIZE;
+                    fill_entry(slots[first + j], (disk_entry_t*)dst);
+                }
+            }
+            table_dirty[s + count] = false;
+            count++;
+        }
+        
+        ok = disk_write(table_sector + s, count, buffer);
+        s += count;
     }
     
-    if (find_child(current_dir, new_name) != NULL) {
-        return -3;  // New name already exists
+    kfree(buffer);
+    return ok;
+}
+
+// Write the changed sectors of the bitmap, in stretches like save_table
+static bool save_bitmap(void) {
+    uint32_t sectors = space_sectors_for(next_data_sector);
+    uint32_t s = 0;
+    bool ok = true;
+    while (ok && s < sectors) {
+        if (!space_dirty[s]) {
+            s++;
+            continue;
+        }
+        
+        uint32_t count = 0;
+        while (s + count < sectors && count < TABLE_BATCH && space_dirty[s + count]) {
+            space_dirty[s + count] = false;
+            count++;
+        }
+        
+        ok = disk_write(bitmap_sector + s, count, (uint8_t*)space_used + s * ATA_SECTOR_SIZE);
+        s += count;
+    }
+    return ok;
+}
+
+// Write this save's sectors: directly or into the transaction
+static bool save_image(bool full) {
+    if (full) {
+        // Free what was freed since the last checkpoint for reuse
+        if (image_on_disk && !journal_checkpoint()) {
+            return false;
+        }
+        
+        // Every run is laid out anew around the committed image, which
+        // stays held until the new one has replaced it
+        memset(space_used, 0, space_capacity / 8);
+        memset(space_dirty, true, space_capacity / SPACE_BITS_PER_SECTOR);
+        table_sector = 0;
+        table_sectors = 0;
+        bitmap_sector = 0;
+        bitmap_sectors = 0;
+        alloc_hint = DATA_START;
     }
     
-    strcpy(node->name, new_name);
-    node->modified = get_time();
-    
-    return 0;
+    save_pass++;
+    return save_data(full) && table_place() && bitmap_place() &&
+           save_table() && save_bitmap();
 }
 
-int fs_copy(const char* src, const char* dest) {
-    fs_node_t* src_file = find_child(current_dir, src);
-    if (src_file == NULL || src_file->type != FS_FILE) {
-        return -1;
+// Make the save durable: through the journal, or for a brand-new image by
+// writing its header last
+static bool save_commit(void) {
+    disk_header_t header;
+    header.magic = FS_MAGIC;
+    header.version = FS_VERSION;
+    header.entry_count = slot_count;
+    header.next_data_sector = next_data_sector;
+    header.table_sector = table_sector;
+    header.table_sectors = table_sectors;
+    header.bitmap_sector = bitmap_sector;
+    header.bitmap_sectors = bitmap_sectors;
+    header.journal_tail = journal_tail;
+    header.journal_sequence = tail_sequence;
+    
+    if (!image_on_disk) {
+        if (!journal_reset()) {
+            return false;
+        }
+        header.journal_tail = journal_tail;
+        header.journal_sequence = tail_sequence;
+        if (!write_header(&header)) {
+            return false;
+        }
+    } else {
+        if (memcmp(&header, &committed, sizeof(header)) != 0) {
+            uint8_t sector_buf[ATA_SECTOR_SIZE];
+            memset(sector_buf, 0, sizeof(sector_buf));
+            memcpy(sector_buf, &header, sizeof(header));
+            if (!tx_add(FS_START_SECTOR, sector_buf)) {
+                return false;
+            }
+        }
+        if (!journal_append()) {
+            return false;
+        }
     }
     
-    fs_node_t* dest_file = fs_create(dest);
-    if (dest_file == NULL) {
-        return -2;
+    committed = header;
+    image_on_disk = true;
+    space_commit();
+    
+    // Checkpoint well before the journal fills, so a commit rarely waits
+    if (journal_used() > JOURNAL_SECTORS / 2) {
+        journal_checkpoint();
+    }
+    return true;
+}
+
+bool fs_save(void) {
+    if (!ata_is_present() || root_dir == NULL) {
+        return false;
     }
     
-    if (src_file->size > 0) {
-        return fs_write(dest_file, src_file->data, src_file->size);
+    save_sectors = 0;
+    
+    // Write everything when the disk holds no image of this tree. Should
+    // the save fail half way, memory and disk no longer match.
+    bool full = !image_valid;
+    image_valid = false;
+    bool ok = save_image(full);
+    if (ok && tx_overflow) {
+        // Too much for the journal: lay out a fresh image instead
+        tx_reset();
+        ok = save_image(true);
     }
+    ok = ok && save_commit();
+    tx_reset();
     
-    return 0;
+    image_valid = ok;
+    return ok;
 }
 
-// ============================================================================
-// Disk Persistence - Simple flat file format
-// ============================================================================
-
-#define FS_MAGIC        0x4B414946  // "KAIF" - KaiOS File System
-#define FS_VERSION      1
-#define FS_START_SECTOR 100         // Start saving at sector 100
-
-// On-disk file entry structure (fixed size for easy serialization)
+// What fs_load keeps of each entry once its node exists
 typedef struct {
-    char name[FS_MAX_NAME];
-    uint8_t type;           // 0 = file, 1 = directory
-    uint32_t size;          // File size
-    uint32_t parent_id;     // Parent node ID
-    uint32_t data_sector;   // Starting sector for file data
-    uint32_t data_sectors;  // Number of sectors used for data
-} PACKED disk_entry_t;
+    uint32_t parent;
+    uint32_t size;
+    uint32_t data_sector;
+    uint32_t data_sectors;
+} load_entry_t;
 
-// On-disk header
+// Runs already loaded, by start sector, so that copies share again
 typedef struct {
-    uint32_t magic;
-    uint32_t version;
-    uint32_t entry_count;
-    uint32_t next_data_sector;
-} PACKED disk_header_t;
-
-static bool disk_available = false;
-
-bool fs_has_disk(void) {
-    return disk_available && ata_is_present();
-}
+    uint32_t* slots;            // Slot + 1 of the first file using the run
+    uint32_t mask;
+} run_map_t;
 
-// Assign IDs to nodes for serialization
-static uint32_t assign_node_ids(fs_node_t* node, uint32_t id, fs_node_t** node_list, uint32_t max_nodes) {
-    if (node == NULL || id >= max_nodes) return id;
-    
-    node_list[id] = node;
-    uint32_t next_id = id + 1;
+static fs_node_t* load_node(disk_entry_t* entry, uint32_t i, fs_node_t** nodes,
+                            load_entry_t* info, run_map_t* runs, uint32_t image_end) {
+    uint8_t type = (i == 0 || entry->type == FS_DIRECTORY) ? FS_DIRECTORY : FS_FILE;
+    entry->name[FS_MAX_NAME - 1] = '\0';
+    
+    fs_node_t* node = node_alloc(type);
+    if (node == NULL || !set_name(node, entry->name)) {
+        if (node) node_free(node);
+        return NULL;
+    }
     
-    for (size_t i = 0; i < node->child_count; i++) {
-        next_id = assign_node_ids(node->children[i], next_id, node_list, max_nodes);
+    if (type != FS_FILE || entry->size == 0) {
+        return node;
     }
     
-    return next_id;
-}
-
-// Find node ID in list
-static uint32_t find_node_id(fs_node_t* node, fs_node_t** node_list, uint32_t count) {
-    for (uint32_t i = 0; i < count; i++) {
-        if (node_list[i] == node) return i;
+    // Only note where the data is; fs_read and friends fetch it. A file
+    // whose run is damaged comes back empty.
+    fs_file_node_t* file = as_file(node);
+    if (entry->data_sectors == 0) {
+        if (entry->size <= FS_INLINE_DATA) {
+            memcpy(file->inline_data, entry->inline_data, entry->size);
+            node->flags |= FS_NODE_INLINE;
+            node->size = entry->size;
+        }
+        return node;
     }
-    return 0;  // Default to root
-}
-
-bool fs_save(void) {
-    if (!ata_is_present()) {
-        return false;
+    if ((entry->size + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE > entry->data_sectors ||
+        entry->data_sector < DATA_START || entry->data_sector >= image_end ||
+        entry->data_sectors > image_end - entry->data_sector) {
+        return node;  // Run too small for the size or outside the image
     }
     
-    // Collect all nodes
-    fs_node_t* node_list[FS_MAX_FILES];
-    memset(node_list, 0, sizeof(node_list));
-    
-    uint32_t node_count = assign_node_ids(root_dir, 0, node_list, FS_MAX_FILES);
-    
-    // Prepare header
-    disk_header_t header;
-    header.magic = FS_MAGIC;
-    header.version = FS_VERSION;
-    header.entry_count = node_count;
-    header.next_data_sector = FS_START_SECTOR + 1 + ((node_count * sizeof(disk_entry_t) + 511) / 512);
-    
-    // Write header
-    uint8_t sector_buf[512];
-    memset(sector_buf, 0, 512);
-    memcpy(sector_buf, &header, sizeof(header));
-    
-    if (!ata_write_sectors(FS_START_SECTOR, 1, sector_buf)) {
-        return false;
+    uint32_t slot = (entry->data_sector * 2654435761U) & runs->mask;
+    while (runs->slots[slot] != 0) {
+        uint32_t j = runs->slots[slot] - 1;
+        if (info[j].data_sector == entry->data_sector) {
+            fs_data_t* data = run_data(nodes[j]);
+            if (data != NULL && nodes[j]->size == entry->size) {
+                data->refcount++;
+                file->data = data;
+                node->size = entry->size;
+            }
+            return node;
+        }
+        slot = (slot + 1) & runs->mask;
     }
     
-    // Write entries and file data
-    uint32_t current_sector = FS_START_SECTOR + 1;
-    uint32_t data_sector = header.next_data_sector;
+    fs_data_t* data = data_create();
+    if (data != NULL) {
+        data->disk_sector = entry->data_sector;
+        data->disk_sectors = entry->data_sectors;
+        data->dirty_to = 0;
+        data->evicted = true;
+        file->data = data;
+        node->size = entry->size;
+        runs->slots[slot] = i + 1;
+    }
+    return node;
+}
+
+// Create the nodes of all entries, streaming the table in TABLE_BATCH
+// sector transfers. Nodes are left unlinked.
+static bool load_entries(const disk_header_t* header, fs_node_t** nodes, load_entry_t* info) {
+    uint32_t count = header->entry_count;
+    uint32_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
     
-    for (uint32_t i = 0; i < node_count; i++) {
-        fs_node_t* node = node_list[i];
+    run_map_t runs;
+    runs.slots = (uint32_t*)kcalloc(capacity, sizeof(uint32_t));
+    runs.mask = capacity - 1;
+    uint8_t* buffer = (uint8_t*)kmalloc(TABLE_BATCH * ATA_SECTOR_SIZE);
+    bool ok = runs.slots != NULL && buffer != NULL;
+    
+    uint32_t per_batch = TABLE_BATCH * ENTRIES_PER_SECTOR;
+    for (uint32_t first = 0; ok && first < count; first += per_batch) {
+        uint32_t entries = count - first < per_batch ? count - first : per_batch;
+        ok = ata_read_sectors(header->table_sector + first / ENTRIES_PER_SECTOR,
+                              table_sectors_for(entries), buffer);
         
-        disk_entry_t entry;
-        memset(&entry, 0, sizeof(entry));
-        strncpy(entry.name, node->name, FS_MAX_NAME - 1);
-        entry.type = (uint8_t)node->type;
-        entry.size = node->size;
-        entry.parent_id = find_node_id(node->parent, node_list, node_count);
-        
-        // Write file data if it's a file with content
-        if (node->type == FS_FILE && node->size > 0 && node->data != NULL) {
-            entry.data_sector = data_sector;
-            entry.data_sectors = (node->size + 511) / 512;
-            
-            // Write file data sectors
-            uint8_t* data_buf = (uint8_t*)kmalloc(entry.data_sectors * 512);
-            if (data_buf) {
-                memset(data_buf, 0, entry.data_sectors * 512);
-                memcpy(data_buf, node->data, node->size);
-                ata_write_sectors(data_sector, entry.data_sectors, data_buf);
-                kfree(data_buf);
+        for (uint32_t j = 0; ok && j < entries; j++) {
+            disk_entry_t* entry = (disk_entry_t*)(buffer + j * DISK_ENTRY_SIZE);
+            uint32_t i = first + j;
+            if (entry->name[0] == '\0') {
+                continue;  // Free slot
             }
             
-            data_sector += entry.data_sectors;
-        } else {
-            entry.data_sector = 0;
-            entry.data_sectors = 0;
+            info[i].parent = entry->parent;
+            info[i].size = entry->size;
+            info[i].data_sector = entry->data_sector;
+            info[i].data_sectors = entry->data_sectors;
+            nodes[i] = load_node(entry, i, nodes, info, &runs, header->next_data_sector);
+            ok = nodes[i] != NULL;
         }
-        
-        // Write entry (multiple entries per sector)
-        uint32_t entries_per_sector = 512 / sizeof(disk_entry_t);
-        uint32_t entry_sector = FS_START_SECTOR + 1 + (i / entries_per_sector);
-        uint32_t entry_offset = (i % entries_per_sector) * sizeof(disk_entry_t);
-        
-        // Read sector, modify, write back
-        if (entry_offset == 0) {
-            memset(sector_buf, 0, 512);
-        } else {
-            ata_read_sectors(entry_sector, 1, sector_buf);
+    }
+    
+    if (runs.slots) kfree(runs.slots);
+    if (buffer) kfree(buffer);
+    return ok;
+}
+
+// Mark the nodes that can be reached from the root. Each walk up the
+// parents stops at the first node already decided, so this is O(n).
+#define LOAD_UNKNOWN    0
+#define LOAD_REACHABLE  1
+#define LOAD_DROPPED    2
+#define LOAD_VISITING   3
+
+static void load_reachable(fs_node_t** nodes, const load_entry_t* info, uint8_t* state, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (nodes[i] == NULL) {
+            state[i] = LOAD_DROPPED;
+        }
+    }
+    state[0] = LOAD_REACHABLE;
+    
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t j = i;
+        while (state[j] == LOAD_UNKNOWN) {
+            state[j] = LOAD_VISITING;
+            if (nodes[j]->parent == NULL) {
+                break;
+            }
+            j = info[j].parent;
         }
         
-        memcpy(sector_buf + entry_offset, &entry, sizeof(entry));
-        
-        // Write when sector is full or last entry
-        if (entry_offset + sizeof(disk_entry_t) >= 512 || i == node_count - 1) {
-            ata_write_sectors(entry_sector, 1, sector_buf);
+        // Ending on a node being visited means no parent, or a cycle
+        uint8_t result = state[j] == LOAD_REACHABLE ? LOAD_REACHABLE : LOAD_DROPPED;
+        for (j = i; state[j] == LOAD_VISITING; j = info[j].parent) {
+            state[j] = result;
+            if (nodes[j]->parent == NULL) {
+                break;
+            }
+        }
+    }
+}
+
+// Hold every sector of the image up to end until its runs are known
+static void load_hold_all(uint32_t end) {
+    memset(space_saved, 0, space_capacity / 8);
+    space_set(space_saved, DATA_START, end - DATA_START, true);
+    space_release();
+}
+
+// Mark a run of the image being loaded as used. False if it overlaps one
+// marked before.
+static bool load_run(uint32_t start, uint32_t length) {
+    for (uint32_t sector = start; sector < start + length; sector++) {
+        if (space_test(space_used, sector)) {
+            return false;
+        }
+    }
+    space_set(space_used, start, length, true);
+    return true;
+}
+
+// Read the saved bitmap into space_saved
+static bool load_bitmap(const disk_header_t* header) {
+    uint32_t sectors = space_sectors_for(header->next_data_sector);
+    uint8_t* map = (uint8_t*)space_saved;
+    memset(map, 0, space_capacity / 8);
+    for (uint32_t s = 0; s < sectors; s += TABLE_BATCH) {
+        uint32_t count = sectors - s < TABLE_BATCH ? sectors - s : TABLE_BATCH;
+        if (!ata_read_sectors(header->bitmap_sector + s, count, map + s * ATA_SECTOR_SIZE)) {
+            return false;
         }
     }
     
+    // Bits past the end of the image mean nothing
+    uint32_t end = DATA_START + space_capacity;
+    space_set(space_saved, header->next_data_sector, end - header->next_data_sector, false);
     return true;
 }
 
@@ -586,117 +2577,152 @@ bool fs_load(void) {
     disk_available = true;
     
     // Read header
-    uint8_t sector_buf[512];
+    uint8_t sector_buf[ATA_SECTOR_SIZE];
     if (!ata_read_sectors(FS_START_SECTOR, 1, sector_buf)) {
         return false;
     }
     
-    disk_header_t* header = (disk_header_t*)sector_buf;
+    disk_header_t header;
+    memcpy(&header, sector_buf, sizeof(header));
     
     // Check magic and version
-    if (header->magic != FS_MAGIC || header->version != FS_VERSION) {
+    if (header.magic != FS_MAGIC || header.version != FS_VERSION ||
+        header.journal_tail >= JOURNAL_SECTORS) {
         return false;  // No valid filesystem, will use defaults
     }
     
-    if (header->entry_count == 0 || header->entry_count > FS_MAX_FILES) {
+    // Finish what the last run committed but did not checkpoint
+    uint32_t tail = header.journal_tail;
+    if (!journal_replay(&header)) {
         return false;
     }
-    
-    // Read all entries first
-    disk_entry_t* entries = (disk_entry_t*)kmalloc(header->entry_count * sizeof(disk_entry_t));
-    if (entries == NULL) {
+    if (header.journal_tail != tail && !write_header(&header)) {
         return false;
     }
     
-    uint32_t entries_per_sector = 512 / sizeof(disk_entry_t);
-    uint32_t sectors_needed = (header->entry_count + entries_per_sector - 1) / entries_per_sector;
+    uint32_t count = header.entry_count;
+    if (count == 0 || header.table_sector < DATA_START ||
+        header.table_sector >= header.next_data_sector ||
+        table_sectors_for(count) > header.table_sectors ||
+        header.table_sectors > header.next_data_sector - header.table_sector ||
+        header.bitmap_sector < DATA_START || header.bitmap_sector >= header.next_data_sector ||
+        space_sectors_for(header.next_data_sector) > header.bitmap_sectors ||
+        header.bitmap_sectors > header.next_data_sector - header.bitmap_sector ||
+        !space_grow(header.next_data_sector)) {
+        return false;
+    }
     
-    for (uint32_t s = 0; s < sectors_needed; s++) {
-        ata_read_sectors(FS_START_SECTOR + 1 + s, 1, sector_buf);
-        
-        uint32_t start_entry = s * entries_per_sector;
-        uint32_t end_entry = start_entry + entries_per_sector;
-        if (end_entry > header->entry_count) end_entry = header->entry_count;
-        
-        for (uint32_t i = start_entry; i < end_entry; i++) {
-            memcpy(&entries[i], sector_buf + ((i - start_entry) * sizeof(disk_entry_t)), sizeof(disk_entry_t));
+    // Until the runs are known, the whole image is held, and nothing is
+    // evicted while the old tree is on its way out
+    image_valid = false;
+    committed = header;
+    image_on_disk = true;
+    journal_head = journal_tail = header.journal_tail;
+    journal_sequence = tail_sequence = header.journal_sequence;
+    load_hold_all(header.next_data_sector);
+    
+    fs_node_t** nodes = (fs_node_t**)kcalloc(count, sizeof(fs_node_t*));
+    load_entry_t* info = (load_entry_t*)kcalloc(count, sizeof(load_entry_t));
+    uint8_t* state = (uint8_t*)kcalloc(count, 1);
+    bool ok = nodes != NULL && info != NULL && state != NULL && slots_grow(count) &&
+              load_entries(&header, nodes, info) && nodes[0] != NULL;
+    
+    if (ok) {
+        // Link parents and children
+        nodes[0]->parent = nodes[0];
+        for (uint32_t i = 1; i < count; i++) {
+            uint32_t parent = info[i].parent;
+            if (nodes[i] != NULL && parent < count && parent != i &&
+                nodes[parent] != NULL && nodes[parent]->type == FS_DIRECTORY) {
+                dir_add_child(as_dir(nodes[parent]), nodes[i]);
+            }
+        }
+        load_reachable(nodes, info, state, count);
+    } else if (nodes != NULL) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (nodes[i]) node_destroy(nodes[i]);
         }
     }
     
-    // Create nodes array
-    fs_node_t** nodes = (fs_node_t**)kmalloc(header->entry_count * sizeof(fs_node_t*));
-    if (nodes == NULL) {
-        kfree(entries);
+    if (!ok) {
+        if (nodes) kfree(nodes);
+        if (info) kfree(info);
+        if (state) kfree(state);
         return false;
     }
     
-    // First pass: create all nodes
-    for (uint32_t i = 0; i < header->entry_count; i++) {
-        fs_node_t* node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-        if (node == NULL) {
-            // Cleanup on failure
-            for (uint32_t j = 0; j < i; j++) {
-                if (nodes[j]->data) kfree(nodes[j]->data);
-                kfree(nodes[j]);
+    // Handles point into the old tree
+    memset(open_files, 0, sizeof(open_files));
+    
+    // Replace root_dir
+    if (root_dir != NULL) {
+        free_tree(root_dir);
+    }
+    slots_reset();
+    slot_count = count;
+    
+    // Entries that cannot be reached from the root (bad parent, a cycle or
+    // out of memory) are dropped and their slots freed on the next save
+    for (uint32_t i = count; i-- > 0;) {
+        fs_node_t* node = nodes[i];
+        if (state[i] != LOAD_REACHABLE) {
+            free_slots[free_count++] = i;
+            if (node != NULL) {
+                table_dirty[i / ENTRIES_PER_SECTOR] = true;
             }
-            kfree(nodes);
-            kfree(entries);
-            return false;
+            continue;
         }
         
-        memset(node, 0, sizeof(fs_node_t));
-        strcpy(node->name, entries[i].name);
-        node->type = (fs_type_t)entries[i].type;
-        node->size = entries[i].size;
-        node->created = get_time();
-        node->modified = node->created;
-        
-        // Load file data
-        if (node->type == FS_FILE && entries[i].size > 0 && entries[i].data_sectors > 0) {
-            uint8_t* data_buf = (uint8_t*)kmalloc(entries[i].data_sectors * 512);
-            if (data_buf) {
-                ata_read_sectors(entries[i].data_sector, entries[i].data_sectors, data_buf);
-                node->data = (uint8_t*)kmalloc(entries[i].size);
-                if (node->data) {
-                    memcpy(node->data, data_buf, entries[i].size);
-                }
-                kfree(data_buf);
-            }
+        slots[i] = node;
+        node->slot = i + 1;
+        if (node->size != info[i].size) {
+            mark_dirty(node);
         }
-        
-        nodes[i] = node;
     }
     
-    // Second pass: link parents and children
-    for (uint32_t i = 0; i < header->entry_count; i++) {
-        fs_node_t* node = nodes[i];
-        uint32_t parent_id = entries[i].parent_id;
-        
-        if (i == 0) {
-            // Root node
-            node->parent = node;
-        } else if (parent_id < header->entry_count) {
-            node->parent = nodes[parent_id];
-            
-            // Add to parent's children
-            fs_node_t* parent = nodes[parent_id];
-            if (parent->child_count < FS_MAX_CHILDREN) {
-                parent->children[parent->child_count++] = node;
-            }
+    // Every descendant of a dropped node is dropped too, cycles included,
+    // so each is destroyed on its own without following the links
+    for (uint32_t i = 1; i < count; i++) {
+        if (nodes[i] != NULL && state[i] != LOAD_REACHABLE) {
+            node_destroy(nodes[i]);
         }
     }
     
-    // Replace root_dir
-    if (root_dir != NULL) {
-        // Free old tree (simplified - just free root for now)
-        kfree(root_dir);
+    // Rebuild the bitmap from the runs. Overlapping runs are repaired by
+    // writing everything anew; a saved bitmap that merely disagrees (or
+    // cannot be read) is rewritten. Runs of dropped entries are free.
+    next_data_sector = header.next_data_sector;
+    table_sector = header.table_sector;
+    table_sectors = header.table_sectors;
+    bitmap_sector = header.bitmap_sector;
+    bitmap_sectors = header.bitmap_sectors;
+    alloc_hint = DATA_START;
+    memset(space_used, 0, space_capacity / 8);
+    bool runs_valid = load_run(table_sector, table_sectors) && load_run(bitmap_sector, bitmap_sectors);
+    save_pass++;
+    for (uint32_t i = 0; runs_valid && i < count; i++) {
+        fs_data_t* data = run_data(slots[i]);
+        if (data != NULL && data->save_pass != save_pass) {
+            data->save_pass = save_pass;
+            runs_valid = load_run(data->disk_sector, data->disk_sectors);
+        }
+    }
+    
+    if (runs_valid) {
+        bool same = load_bitmap(&header) &&
+                    memcmp(space_saved, space_used, space_capacity / 8) == 0;
+        memset(space_dirty, !same, space_capacity / SPACE_BITS_PER_SECTOR);
+        space_commit();
+        space_release();
+        image_valid = true;
     }
     
     root_dir = nodes[0];
     current_dir = root_dir;
     
     kfree(nodes);
-    kfree(entries);
+    kfree(info);
+    kfree(state);
     
     return true;
 }
@@ -5,8 +5,10 @@
 
 #include "include/kernel/gui.h"
 #include "include/kernel/fs.h"
-#include "include/kernel/memory.h"
+#include "include/kernel/slab.h"
+#include "include/kernel/arena.h"
 #include "include/kernel/string.h"
+#include "include/kernel/printf.h"
 #include "include/drivers/graphics.h"
 #include "include/drivers/mouse.h"
 #include "include/drivers/keyboard.h"
@@ -15,6 +17,12 @@
 // Global GUI state
 static gui_state_t gui;
 
+// Object cache for windows
+static slab_cache_t* window_cache = NULL;
+
+// Per-frame scratch arena
+static arena_t frame_arena;
+
 // Cursor bitmap (8x11 - smaller cursor)
 static const uint8_t cursor_data[11][8] = {
     {1,0,0,0,0,0,0,0},
@@ -156,6 +164,11 @@ void gui_draw_cursor(int16_t x, int16_t y) {
 void gui_init(void) {
     memset(&gui, 0, sizeof(gui_state_t));
     
+    if (window_cache == NULL) {
+        window_cache = slab_cache_create("window", sizeof(window_t), 0);
+    }
+    arena_init(&frame_arena, 0);
+    
     // Graphics already initialized by splash screen, just setup palette
     gfx_setup_palette();
     
@@ -221,7 +234,7 @@ void gui_toggle_start_menu(void) {
 window_t* gui_create_window(const char* title, int16_t x, int16_t y, int16_t w, int16_t h) {
     if (gui.window_count >= GUI_MAX_WINDOWS) return NULL;
     
-    window_t* window = (window_t*)kmalloc(sizeof(window_t));
+    window_t* window = (window_t*)slab_alloc(window_cache);
     if (!window) return NULL;
     
     memset(window, 0, sizeof(window_t));
@@ -260,7 +273,7 @@ void gui_destroy_window(window_t* window) {
         gui.active_window = gui.window_count > 0 ? gui.windows[gui.window_count - 1] : NULL;
     }
     
-    kfree(window);
+    slab_free(window_cache, window);
     gui.redraw_needed = true;
 }
 
@@ -382,50 +395,15 @@ void gui_draw_taskbar(void) {
         if (btn_x > GFX_WIDTH - 70) break;
     }
     
-    // Clock area (just show uptime for now)
+    // Clock area (just show uptime for now, as MM:SS)
     uint32_t uptime = timer_get_ticks() / 100;
     char time_str[16];
-    
-    // Debug: Show mouse packet count
-    // sprintf(time_str, "%d", mouse_packet_count);
-    
-    // Format time MM:SS
-    time_str[0] = '0' + (uptime / 600) % 6;
-    time_str[1] = '0' + (uptime / 60) % 10;
-    time_str[2] = ':';
-    time_str[3] = '0' + (uptime % 60) / 10;
-    time_str[4] = '0' + (uptime % 60) % 10;
-    time_str[5] = '\0';
-    
+    ksnprintf(time_str, sizeof(time_str), "%02u:%02u", (uptime / 60) % 60, uptime % 60);
     gfx_puts(GFX_WIDTH - 40, y + 6, time_str, COLOR_WHITE, 255);
     
-    // Debug: Show mouse coordinates in top right
+    // Debug: Show mouse packet count in top right
     char debug_str[32];
-    // Simple int to string conversion
-    int mx = gui.mouse_x;
-    int my = gui.mouse_y;
-    int mp = mouse_packet_count;
-    
-    // Manual itoa since we don't have sprintf
-    int idx = 0;
-    debug_str[idx++] = 'M';
-    debug_str[idx++] = ':';
-    
-    // Packet count
-    if (mp == 0) debug_str[idx++] = '0';
-    else {
-        int temp = mp;
-        int digits = 0;
-        while (temp > 0) { temp /= 10; digits++; }
-        temp = mp;
-        for (int i = 0; i < digits; i++) {
-            int p = 1;
-            for (int j = 0; j < digits - 1 - i; j++) p *= 10;
-            debug_str[idx++] = '0' + (temp / p) % 10;
-        }
-    }
-    debug_str[idx] = '\0';
-    
+    ksnprintf(debug_str, sizeof(debug_str), "M:%u", mouse_packet_count);
     gfx_puts(GFX_WIDTH - 80, 2, debug_str, COLOR_WHITE, 0); // Transparent bg
 }
 
@@ -855,12 +833,14 @@ void gui_show_splash(void) {
 void gui_run(void) {
     // Force initial draw
     gui_draw();
+    arena_reset(&frame_arena);
     
     while (gui.initialized) {
         gui_update();
         
         // Always redraw to show cursor movement
         gui_draw();
+        arena_reset(&frame_arena);
         
         // Small delay to prevent 100% CPU
         for (volatile int i = 0; i < 50000; i++);
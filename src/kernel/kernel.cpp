@@ -5,28 +5,23 @@
 
 #include "include/kernel/types.h"
 #include "include/kernel/idt.h"
+#include "include/kernel/cpu.h"
 #include "include/kernel/memory.h"
+#include "include/kernel/multiboot.h"
+#include "include/kernel/pmm.h"
+#include "include/kernel/paging.h"
+#include "include/kernel/string.h"
+#include "include/kernel/printf.h"
 #include "include/kernel/fs.h"
 #include "include/kernel/shell.h"
 #include "include/kernel/gui.h"
 #include "include/drivers/vga.h"
+#include "include/drivers/serial.h"
 #include "include/drivers/keyboard.h"
 #include "include/drivers/timer.h"
 #include "include/drivers/ata.h"
 #include "include/drivers/mouse.h"
 
-// Multiboot magic number check
-#define MULTIBOOT_MAGIC 0x2BADB002
-
-// Multiboot info structure (partial)
-struct multiboot_info {
-    uint32_t flags;
-    uint32_t mem_lower;
-    uint32_t mem_upper;
-    uint32_t boot_device;
-    uint32_t cmdline;  // Physical address of command line
-};
-
 // Boot mode - can be changed to boot into shell instead
 static bool gui_mode = true;
 
@@ -61,9 +56,11 @@ static void mouse_irq_handler(registers_t* regs) {
     mouse_handler();
 }
 
-extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
-    // Initialize VGA display first (so we can show output)
+extern "C" void kernel_main(uint32_t magic, multiboot_info_t* mboot_info) {
+    // Initialize VGA display first (so we can show output), then the
+    // serial port that mirrors console and log output
     vga_init();
+    serial_init();
     
     // Clear screen and show boot message
     vga_clear();
@@ -71,6 +68,7 @@ extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
     vga_writestring("KaiOS - Lightweight Operating System\n");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     vga_writestring("Booting kernel...\n\n");
+    klog("KaiOS booting\n");
     
     // Check multiboot magic and parse command line
     if (magic == MULTIBOOT_MAGIC) {
@@ -80,7 +78,7 @@ extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
         vga_writestring("Multiboot verified\n");
         
         // Check if command line is present (bit 2 of flags)
-        if (mboot_info && (mboot_info->flags & 0x04)) {
+        if (mboot_info && (mboot_info->flags & MULTIBOOT_INFO_CMDLINE)) {
             const char* cmdline = (const char*)mboot_info->cmdline;
             if (str_contains(cmdline, "mode=term")) {
                 gui_mode = false;
@@ -103,6 +101,44 @@ extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
         vga_writestring("Invalid multiboot magic\n");
     }
     
+    // Initialize physical memory from the multiboot memory map
+    pmm_init(magic == MULTIBOOT_MAGIC ? mboot_info : NULL);
+    
+    if (pmm_total_pages() > 0) {
+        uint32_t mb = pmm_total_pages() / (1024 * 1024 / PMM_PAGE_SIZE);
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_writestring("[OK] ");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        kprintf("Physical memory: %u MB usable\n", mb);
+        klog("pmm: %u pages (%u MB) usable\n", pmm_total_pages(), mb);
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_writestring("[WARN] ");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        vga_writestring("No usable memory map from bootloader\n");
+    }
+    
+    // Enable paging (identity map with 4 MB pages)
+    cpu_init();
+    paging_init(magic == MULTIBOOT_MAGIC ? mboot_info : NULL);
+    klog("cpu: %s, sse %s; paging %s\n", cpu_vendor(),
+         cpu_sse_enabled() ? (cpu_has_feature(CPU_FEATURE_SSE2) ? "sse2" : "on") : "off",
+         paging_enabled() ? "on" : "off");
+    
+    if (paging_enabled()) {
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_writestring("[OK] ");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        vga_writestring("Paging enabled");
+        vga_writestring(cpu_has_feature(CPU_FEATURE_PSE) ? " (4 MB pages" : " (4 KB pages");
+        vga_writestring(paging_write_combining() ? ", write-combining framebuffer)\n" : ")\n");
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_writestring("[WARN] ");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        vga_writestring("Paging not enabled\n");
+    }
+    
     // Initialize memory management
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_writestring("[OK] ");
@@ -146,6 +182,7 @@ extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     vga_writestring("Initializing ATA disk driver...\n");
     ata_init();
+    klog("ata: primary master %s\n", ata_is_present() ? "present" : "absent");
     
     if (ata_is_present()) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -170,6 +207,7 @@ extern "C" void kernel_main(uint32_t magic, multiboot_info* mboot_info) {
     if (ata_is_present()) {
         loaded_from_disk = fs_load();
     }
+    klog("fs: %s\n", loaded_from_disk ? "loaded from disk" : "created in memory");
     
     if (loaded_from_disk) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -1,137 +1,783 @@
 /*
  * KaiOS - Memory Management Implementation
- * Simple heap allocator with linked list
+ * TLSF (two-level segregated fit) heap allocator
+ *
+ * Free blocks are kept on segregated lists indexed by a two-level bitmap,
+ * so both kmalloc and kfree run in constant time regardless of how many
+ * blocks the heap has been split into. Boundary tags let kfree coalesce
+ * with both physical neighbours without walking anything.
  */
 
 #include "include/kernel/memory.h"
+#include "include/kernel/pmm.h"
 #include "include/kernel/string.h"
 
-// Heap memory area
-static uint8_t heap_memory[HEAP_SIZE];
-static memory_block_t* heap_start = NULL;
+// Block size flags (stored in the low bits of memory_block_t::size)
+#define BLOCK_FREE      0x1
+#define BLOCK_PREV_FREE 0x2
+#define BLOCK_FLAGS     (BLOCK_FREE | BLOCK_PREV_FREE)
+
+// Bytes in front of the payload (prev_phys + size)
+#define BLOCK_HEADER_SIZE  __builtin_offsetof(memory_block_t, next_free)
+
+// Smallest payload: must hold the free-list links
+#define BLOCK_SIZE_MIN     (sizeof(memory_block_t) - BLOCK_HEADER_SIZE)
+#define BLOCK_SIZE_MAX     ((size_t)1 << TLSF_FL_INDEX_MAX)
+
+// Pool header, rounded so the first block stays aligned
+#define POOL_HEADER_SIZE   ((sizeof(heap_pool_t) + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1))
+
+// Heap pools (the first one is never returned to the PMM)
+static heap_pool_t* pools = NULL;
+static heap_pool_t* initial_pool = NULL;
+
+// Running statistics (kept up to date by every operation so that
+// reporting them never has to walk the heap)
 static size_t total_allocated = 0;
+static size_t peak_allocated = 0;
+static size_t free_bytes = 0;
+static size_t heap_bytes = 0;
+static uint32_t free_block_count = 0;
+static uint32_t pool_count = 0;
+static uint32_t alloc_count = 0;
+static uint32_t free_count = 0;
+static uint32_t failed_count = 0;
+static uint32_t reclaim_count = 0;
+static size_t reclaimed_bytes = 0;
+static uint32_t size_histogram[HEAP_HIST_BUCKETS];
 
-void memory_init(void) {
-    // Initialize the first block covering the entire heap
-    heap_start = (memory_block_t*)heap_memory;
-    heap_start->size = HEAP_SIZE - sizeof(memory_block_t);
-    heap_start->free = true;
-    heap_start->next = NULL;
-    heap_start->prev = NULL;
-    total_allocated = 0;
+// Registered shrinkers, sorted by priority
+typedef struct {
+    const char* name;
+    shrinker_fn_t fn;
+    int priority;
+} shrinker_t;
+
+static shrinker_t shrinkers[SHRINKER_MAX];
+static int shrinker_count = 0;
+static bool reclaiming = false;
+
+// Segregated free lists and their bitmaps
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[TLSF_FL_INDEX_COUNT];
+static memory_block_t* free_lists[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+
+// ============================================================================
+// Bit helpers
+// ============================================================================
+
+static inline int tlsf_ffs(uint32_t word) {
+    return word ? __builtin_ctz(word) : -1;
+}
+
+static inline int tlsf_fls(uint32_t word) {
+    return word ? 31 - __builtin_clz(word) : -1;
+}
+
+static inline size_t align_up(size_t x, size_t align) {
+    return (x + (align - 1)) & ~(align - 1);
+}
+
+static inline uint8_t* align_ptr(void* ptr, size_t align) {
+    return (uint8_t*)(((uintptr_t)ptr + (align - 1)) & ~(uintptr_t)(align - 1));
+}
+
+// ============================================================================
+// Block helpers
+// ============================================================================
+
+static inline size_t block_size(const memory_block_t* block) {
+    return block->size & ~(size_t)BLOCK_FLAGS;
+}
+
+static inline void block_set_size(memory_block_t* block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS);
+}
+
+static inline bool block_is_free(const memory_block_t* block) {
+    return (block->size & BLOCK_FREE) != 0;
+}
+
+static inline bool block_is_prev_free(const memory_block_t* block) {
+    return (block->size & BLOCK_PREV_FREE) != 0;
+}
+
+static inline void* block_to_ptr(memory_block_t* block) {
+    return (uint8_t*)block + BLOCK_HEADER_SIZE;
+}
+
+static inline memory_block_t* block_from_ptr(void* ptr) {
+    return (memory_block_t*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+}
+
+static inline memory_block_t* block_next(memory_block_t* block) {
+    return (memory_block_t*)((uint8_t*)block_to_ptr(block) + block_size(block));
+}
+
+// Point the next physical block's boundary tag back at this block
+static inline memory_block_t* block_link_next(memory_block_t* block) {
+    memory_block_t* next = block_next(block);
+    next->prev_phys = block;
+    return next;
+}
+
+static void block_mark_free(memory_block_t* block) {
+    memory_block_t* next = block_link_next(block);
+    next->size |= BLOCK_PREV_FREE;
+    block->size |= BLOCK_FREE;
+}
+
+static void block_mark_used(memory_block_t* block) {
+    memory_block_t* next = block_next(block);
+    next->size &= ~(size_t)BLOCK_PREV_FREE;
+    block->size &= ~(size_t)BLOCK_FREE;
+}
+
+// ============================================================================
+// Size class mapping
+// ============================================================================
+
+// Map a block size to the list that holds blocks of exactly that class
+static void mapping_insert(size_t size, int* fli, int* sli) {
+    if (size < TLSF_SMALL_BLOCK_SIZE) {
+        *fli = 0;
+        *sli = (int)(size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT));
+    } else {
+        int fl = tlsf_fls((uint32_t)size);
+        *sli = (int)(size >> (fl - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+        *fli = fl - (TLSF_FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Map a request to the first list whose blocks are all large enough
+static void mapping_search(size_t size, int* fli, int* sli) {
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        size += ((size_t)1 << (tlsf_fls((uint32_t)size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fli, sli);
+}
+
+// ============================================================================
+// Free list management
+// ============================================================================
+
+static void insert_free_block(memory_block_t* block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    memory_block_t* head = free_lists[fl][sl];
+    block->next_free = head;
+    block->prev_free = NULL;
+    if (head != NULL) {
+        head->prev_free = block;
+    }
+    free_lists[fl][sl] = block;
+
+    fl_bitmap |= (1U << fl);
+    sl_bitmap[fl] |= (1U << sl);
+
+    free_bytes += block_size(block);
+    free_block_count++;
+}
+
+static void remove_free_block(memory_block_t* block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    if (block->prev_free != NULL) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_lists[fl][sl] = block->next_free;
+    }
+    if (block->next_free != NULL) {
+        block->next_free->prev_free = block->prev_free;
+    }
+
+    if (free_lists[fl][sl] == NULL) {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (sl_bitmap[fl] == 0) {
+            fl_bitmap &= ~(1U << fl);
+        }
+    }
+
+    free_bytes -= block_size(block);
+    free_block_count--;
 }
 
-// Find a free block of at least the requested size
+// Find a free block of at least the requested size (two bitmap scans)
 static memory_block_t* find_free_block(size_t size) {
-    memory_block_t* current = heap_start;
-    
-    while (current != NULL) {
-        if (current->free && current->size >= size) {
-            return current;
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+
+    if (fl >= TLSF_FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        // Nothing left at this level, go to the next non-empty first level
+        uint32_t fl_map = fl_bitmap & (~0U << (fl + 1));
+        if (fl_map == 0) {
+            return NULL;  // Out of memory
         }
-        current = current->next;
+        fl = tlsf_ffs(fl_map);
+        sl_map = sl_bitmap[fl];
     }
-    
-    return NULL;
+    sl = tlsf_ffs(sl_map);
+
+    memory_block_t* block = free_lists[fl][sl];
+    remove_free_block(block);
+    return block;
 }
 
-// Split a block if it's larger than needed
+// ============================================================================
+// Split and merge
+// ============================================================================
+
+// Split a block if it's larger than needed, returning the remainder to the
+// free lists
 static void split_block(memory_block_t* block, size_t size) {
-    // Only split if remaining space is large enough for a new block
-    if (block->size >= size + sizeof(memory_block_t) + 16) {
-        memory_block_t* new_block = (memory_block_t*)((uint8_t*)(block + 1) + size);
-        new_block->size = block->size - size - sizeof(memory_block_t);
-        new_block->free = true;
-        new_block->next = block->next;
-        new_block->prev = block;
-        
-        if (block->next != NULL) {
-            block->next->prev = new_block;
+    if (block_size(block) < size + BLOCK_HEADER_SIZE + BLOCK_SIZE_MIN) {
+        return;
+    }
+
+    memory_block_t* remaining = (memory_block_t*)((uint8_t*)block_to_ptr(block) + size);
+    remaining->size = block_size(block) - size - BLOCK_HEADER_SIZE;
+    block_set_size(block, size);
+
+    block_link_next(block);
+    block_mark_free(remaining);
+    insert_free_block(remaining);
+}
+
+// Give the first gap bytes of a free block (header included) back to the
+// free lists and return the block that now starts gap bytes further on
+static memory_block_t* split_leading(memory_block_t* block, size_t gap) {
+    memory_block_t* remaining = (memory_block_t*)((uint8_t*)block + gap);
+    remaining->size = (block_size(block) - gap) | BLOCK_FREE | BLOCK_PREV_FREE;
+    block_set_size(block, gap - BLOCK_HEADER_SIZE);
+
+    block_link_next(block);
+    block_link_next(remaining);
+    insert_free_block(block);
+    return remaining;
+}
+
+// Absorb block into its free physical predecessor
+static memory_block_t* merge_prev(memory_block_t* block) {
+    if (block_is_prev_free(block)) {
+        memory_block_t* prev = block->prev_phys;
+        remove_free_block(prev);
+        block_set_size(prev, block_size(prev) + BLOCK_HEADER_SIZE + block_size(block));
+        block_link_next(prev);
+        block = prev;
+    }
+    return block;
+}
+
+// Absorb the free physical successor into block
+static memory_block_t* merge_next(memory_block_t* block) {
+    memory_block_t* next = block_next(block);
+    if (block_is_free(next)) {
+        remove_free_block(next);
+        block_set_size(block, block_size(block) + BLOCK_HEADER_SIZE + block_size(next));
+        block_link_next(block);
+    }
+    return block;
+}
+
+// Shrink a used block to size bytes and release the tail, coalesced with a
+// free successor, to the free lists
+static void trim_used_block(memory_block_t* block, size_t size) {
+    if (block_size(block) < size + BLOCK_HEADER_SIZE + BLOCK_SIZE_MIN) {
+        return;
+    }
+
+    memory_block_t* remaining = (memory_block_t*)((uint8_t*)block_to_ptr(block) + size);
+    remaining->size = block_size(block) - size - BLOCK_HEADER_SIZE;
+    block_set_size(block, size);
+
+    block_link_next(block);
+    block_mark_free(remaining);
+    remaining = merge_next(remaining);
+    insert_free_block(remaining);
+}
+
+// Grow a used block in place by absorbing its free successor. Fails if the
+// successor is not free or the two together are still too small.
+static bool grow_used_block(memory_block_t* block, size_t size) {
+    memory_block_t* next = block_next(block);
+    if (!block_is_free(next) || block_size(block) + BLOCK_HEADER_SIZE + block_size(next) < size) {
+        return false;
+    }
+
+    remove_free_block(next);
+    block_set_size(block, block_size(block) + BLOCK_HEADER_SIZE + block_size(next));
+    block_link_next(block);
+    block_mark_used(block);
+    return true;
+}
+
+// ============================================================================
+// Pools
+// ============================================================================
+
+static inline memory_block_t* pool_first_block(heap_pool_t* pool) {
+    return (memory_block_t*)((uint8_t*)pool + POOL_HEADER_SIZE);
+}
+
+static inline heap_pool_t* pool_from_first_block(memory_block_t* block) {
+    return (heap_pool_t*)((uint8_t*)block - POOL_HEADER_SIZE);
+}
+
+// Take 2^order pages from the PMM and hand them to the allocator as one
+// free block followed by a zero-sized, permanently used sentinel that stops
+// coalescing at the end of the pool
+static heap_pool_t* add_pool(uint32_t order) {
+    uintptr_t addr = pmm_alloc_pages(order);
+    if (addr == 0) {
+        return NULL;
+    }
+
+    heap_pool_t* pool = (heap_pool_t*)addr;
+    pool->order = order;
+    pool->reserved = 0;
+    pool->prev = NULL;
+    pool->next = pools;
+    if (pools != NULL) {
+        pools->prev = pool;
+    }
+    pools = pool;
+    pool_count++;
+    heap_bytes += (size_t)PMM_PAGE_SIZE << order;
+
+    size_t bytes = ((size_t)PMM_PAGE_SIZE << order) - POOL_HEADER_SIZE;
+
+    memory_block_t* block = pool_first_block(pool);
+    block->prev_phys = NULL;
+    block->size = bytes - 2 * BLOCK_HEADER_SIZE;
+    block_mark_free(block);
+
+    memory_block_t* sentinel = block_next(block);
+    sentinel->size = BLOCK_PREV_FREE;  // Size 0, used
+
+    insert_free_block(block);
+    return pool;
+}
+
+// Give a pool that has become entirely free back to the PMM. The block
+// passed in must already be off the free lists.
+static bool release_pool(memory_block_t* block) {
+    if (block->prev_phys != NULL || block_size(block_next(block)) != 0) {
+        return false;  // Not the only block in its pool
+    }
+
+    heap_pool_t* pool = pool_from_first_block(block);
+    if (pool == initial_pool) {
+        return false;
+    }
+
+    if (pool->prev != NULL) {
+        pool->prev->next = pool->next;
+    } else {
+        pools = pool->next;
+    }
+    if (pool->next != NULL) {
+        pool->next->prev = pool->prev;
+    }
+    pool_count--;
+    heap_bytes -= (size_t)PMM_PAGE_SIZE << pool->order;
+
+    pmm_free_pages((uintptr_t)pool, pool->order);
+    return true;
+}
+
+// Grow the heap so that a block of at least size bytes becomes available
+static bool heap_grow(size_t size) {
+    size_t needed = size + POOL_HEADER_SIZE + 2 * BLOCK_HEADER_SIZE;
+    if (needed < HEAP_GROW_MIN) {
+        needed = HEAP_GROW_MIN;
+    }
+    return add_pool(pmm_order_for_size(needed)) != NULL;
+}
+
+// Find a free block, growing the heap if none is large enough and asking
+// the shrinkers for memory if the heap cannot grow
+static memory_block_t* find_or_grow(size_t size) {
+    memory_block_t* block = find_free_block(size);
+    if (block != NULL) {
+        return block;
+    }
+    if (heap_grow(size)) {
+        return find_free_block(size);
+    }
+
+    // Shrinkers may free heap blocks (retry the lists) or pages (grow)
+    if (memory_reclaim(size + POOL_HEADER_SIZE + 2 * BLOCK_HEADER_SIZE) > 0) {
+        block = find_free_block(size);
+        if (block == NULL && heap_grow(size)) {
+            block = find_free_block(size);
         }
-        
-        block->next = new_block;
-        block->size = size;
     }
+    return block;
+}
+
+// ============================================================================
+// Shrinkers
+// ============================================================================
+
+bool memory_register_shrinker(const char* name, shrinker_fn_t fn, int priority) {
+    if (fn == NULL || shrinker_count >= SHRINKER_MAX) {
+        return false;
+    }
+
+    // Insert after every shrinker of equal or lower priority
+    int pos = shrinker_count;
+    while (pos > 0 && shrinkers[pos - 1].priority > priority) {
+        shrinkers[pos] = shrinkers[pos - 1];
+        pos--;
+    }
+    shrinkers[pos].name = name;
+    shrinkers[pos].fn = fn;
+    shrinkers[pos].priority = priority;
+    shrinker_count++;
+    return true;
 }
 
-// Merge adjacent free blocks
-static void merge_blocks(memory_block_t* block) {
-    // Merge with next block if free
-    if (block->next != NULL && block->next->free) {
-        block->size += sizeof(memory_block_t) + block->next->size;
-        block->next = block->next->next;
-        if (block->next != NULL) {
-            block->next->prev = block;
+void memory_unregister_shrinker(shrinker_fn_t fn) {
+    for (int i = 0; i < shrinker_count; i++) {
+        if (shrinkers[i].fn == fn) {
+            for (int j = i + 1; j < shrinker_count; j++) {
+                shrinkers[j - 1] = shrinkers[j];
+            }
+            shrinker_count--;
+            return;
         }
     }
-    
-    // Merge with previous block if free
-    if (block->prev != NULL && block->prev->free) {
-        block->prev->size += sizeof(memory_block_t) + block->size;
-        block->prev->next = block->next;
-        if (block->next != NULL) {
-            block->next->prev = block->prev;
+}
+
+size_t memory_reclaim(size_t bytes) {
+    // A shrinker that allocates while reclaiming must not recurse
+    if (reclaiming) {
+        return 0;
+    }
+    reclaiming = true;
+
+    size_t released = 0;
+    for (int i = 0; i < shrinker_count && released < bytes; i++) {
+        released += shrinkers[i].fn(bytes - released);
+    }
+
+    reclaiming = false;
+    reclaim_count++;
+    reclaimed_bytes += released;
+    return released;
+}
+
+// ============================================================================
+// Call-site tracing (KMALLOC_TRACE builds only)
+// ============================================================================
+
+#ifdef KMALLOC_TRACE
+
+// Return address of the public entry point that is allocating
+#define CALLER __builtin_return_address(0)
+
+// Open-addressing table keyed by return address; entries are never removed
+// so a site found at allocation time is found again on free
+static kmalloc_site_t trace_sites[KMALLOC_TRACE_SITES];
+static kmalloc_site_t trace_overflow;
+
+static kmalloc_site_t* trace_site(void* caller) {
+    uint32_t slot = ((uint32_t)((uintptr_t)caller >> 2) * 2654435761U) % KMALLOC_TRACE_SITES;
+
+    for (uint32_t probe = 0; probe < KMALLOC_TRACE_SITES; probe++) {
+        kmalloc_site_t* site = &trace_sites[slot];
+        if (site->caller == caller) {
+            return site;
         }
+        if (site->caller == NULL) {
+            site->caller = caller;
+            return site;
+        }
+        slot = (slot + 1) % KMALLOC_TRACE_SITES;
     }
+    return &trace_overflow;
 }
 
-void* kmalloc(size_t size) {
+static void trace_alloc(memory_block_t* block, size_t request, void* caller) {
+    block->caller = caller;
+    block->request = request;
+
+    kmalloc_site_t* site = trace_site(caller);
+    site->live_bytes += block_size(block);
+    site->live_count++;
+    site->total_count++;
+}
+
+static void trace_free(memory_block_t* block) {
+    kmalloc_site_t* site = trace_site(block->caller);
+    site->live_bytes -= block_size(block);
+    site->live_count--;
+}
+
+static void trace_resize(memory_block_t* block, size_t old_size, size_t request) {
+    kmalloc_site_t* site = trace_site(block->caller);
+    site->live_bytes = site->live_bytes - old_size + block_size(block);
+    block->request = request;
+}
+
+size_t memory_trace_top(kmalloc_site_t* sites, size_t max) {
+    bool taken[KMALLOC_TRACE_SITES + 1];
+    memset(taken, 0, sizeof(taken));
+
+    size_t count = 0;
+    while (count < max) {
+        // Pick the untaken site holding the most live bytes
+        int best = -1;
+        for (int i = 0; i <= KMALLOC_TRACE_SITES; i++) {
+            kmalloc_site_t* site = (i < KMALLOC_TRACE_SITES) ? &trace_sites[i] : &trace_overflow;
+            if (taken[i] || site->total_count == 0) continue;
+            if (best < 0) {
+                best = i;
+                continue;
+            }
+            kmalloc_site_t* current = (best < KMALLOC_TRACE_SITES) ? &trace_sites[best] : &trace_overflow;
+            if (site->live_bytes > current->live_bytes ||
+                (site->live_bytes == current->live_bytes && site->live_count > current->live_count)) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        taken[best] = true;
+        sites[count++] = (best < KMALLOC_TRACE_SITES) ? trace_sites[best] : trace_overflow;
+    }
+    return count;
+}
+
+#else
+
+#define CALLER NULL
+
+static inline void trace_alloc(memory_block_t* block, size_t request, void* caller) {
+    (void)block;
+    (void)request;
+    (void)caller;
+}
+
+static inline void trace_free(memory_block_t* block) {
+    (void)block;
+}
+
+static inline void trace_resize(memory_block_t* block, size_t old_size, size_t request) {
+    (void)block;
+    (void)old_size;
+    (void)request;
+}
+
+#endif // KMALLOC_TRACE
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+// Histogram bucket for a request size
+static inline int size_bucket(size_t size) {
+    if (size <= ((size_t)1 << HEAP_HIST_MIN_LOG2)) {
+        return 0;
+    }
+    int bucket = tlsf_fls((uint32_t)(size - 1)) + 1 - HEAP_HIST_MIN_LOG2;
+    return bucket < HEAP_HIST_BUCKETS ? bucket : HEAP_HIST_BUCKETS - 1;
+}
+
+// Record a successful allocation of block for a request of size bytes
+static void account_alloc(memory_block_t* block, size_t size) {
+    total_allocated += block_size(block);
+    if (total_allocated > peak_allocated) {
+        peak_allocated = total_allocated;
+    }
+    alloc_count++;
+    size_histogram[size_bucket(size)]++;
+}
+
+// Largest free block: the highest non-empty size class holds it, so only
+// that one list is scanned
+static size_t largest_free_block(void) {
+    if (fl_bitmap == 0) {
+        return 0;
+    }
+    int fl = tlsf_fls(fl_bitmap);
+    int sl = tlsf_fls(sl_bitmap[fl]);
+
+    size_t largest = 0;
+    for (memory_block_t* block = free_lists[fl][sl]; block != NULL; block = block->next_free) {
+        if (block_size(block) > largest) {
+            largest = block_size(block);
+        }
+    }
+    return largest;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+void memory_init(void) {
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    memset(free_lists, 0, sizeof(free_lists));
+    pools = NULL;
+
+    total_allocated = 0;
+    peak_allocated = 0;
+    free_bytes = 0;
+    heap_bytes = 0;
+    free_block_count = 0;
+    pool_count = 0;
+    alloc_count = 0;
+    free_count = 0;
+    failed_count = 0;
+    reclaim_count = 0;
+    reclaimed_bytes = 0;
+    memset(size_histogram, 0, sizeof(size_histogram));
+
+    // Initial arena; later pools are added on demand
+    initial_pool = add_pool(pmm_order_for_size(HEAP_INITIAL_SIZE));
+}
+
+// Round a request up to a valid block size (0 if it can never be satisfied)
+static size_t adjust_request_size(size_t size) {
+    if (size == 0 || size >= BLOCK_SIZE_MAX) {
+        return 0;
+    }
+    size = align_up(size, HEAP_ALIGN);
+    return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+}
+
+// kmalloc proper; caller is the call site to charge in KMALLOC_TRACE builds
+static void* heap_alloc(size_t size, void* caller) {
+    size_t request = size;
+    size = adjust_request_size(size);
     if (size == 0) {
         return NULL;
     }
-    
-    // Align size to 8 bytes
-    size = (size + 7) & ~7;
-    
-    memory_block_t* block = find_free_block(size);
-    
+
+    memory_block_t* block = find_or_grow(size);
+
     if (block == NULL) {
+        failed_count++;
         return NULL;  // Out of memory
     }
-    
+
     split_block(block, size);
-    block->free = false;
-    total_allocated += block->size;
-    
+    block_mark_used(block);
+    account_alloc(block, request);
+    trace_alloc(block, request, caller);
+
     // Return pointer to data area (after the header)
-    return (void*)(block + 1);
+    return block_to_ptr(block);
+}
+
+void* kmalloc(size_t size) {
+    return heap_alloc(size, CALLER);
+}
+
+void* kmalloc_aligned(size_t size, size_t align) {
+    if (align <= HEAP_ALIGN) {
+        return heap_alloc(size, CALLER);
+    }
+
+    size_t request = size;
+    size = adjust_request_size(size);
+    if (size == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+
+    // Over-allocate so that an aligned payload always fits and any leading
+    // gap is big enough to become a free block of its own
+    const size_t gap_minimum = BLOCK_HEADER_SIZE + BLOCK_SIZE_MIN;
+    memory_block_t* block = find_or_grow(size + align + gap_minimum);
+
+    if (block == NULL) {
+        failed_count++;
+        return NULL;  // Out of memory
+    }
+
+    uint8_t* ptr = (uint8_t*)block_to_ptr(block);
+    uint8_t* aligned = align_ptr(ptr, align);
+    size_t gap = aligned - ptr;
+
+    if (gap != 0 && gap < gap_minimum) {
+        aligned = align_ptr(ptr + gap_minimum, align);
+        gap = aligned - ptr;
+    }
+
+    if (gap != 0) {
+        block = split_leading(block, gap);
+    }
+
+    split_block(block, size);
+    block_mark_used(block);
+    account_alloc(block, request);
+    trace_alloc(block, request, CALLER);
+
+    return block_to_ptr(block);
 }
 
 void* kcalloc(size_t num, size_t size) {
     size_t total = num * size;
-    void* ptr = kmalloc(total);
-    
+    void* ptr = heap_alloc(total, CALLER);
+
     if (ptr != NULL) {
         memset(ptr, 0, total);
     }
-    
+
     return ptr;
 }
 
 void* krealloc(void* ptr, size_t size) {
     if (ptr == NULL) {
-        return kmalloc(size);
+        return heap_alloc(size, CALLER);
     }
-    
+
     if (size == 0) {
         kfree(ptr);
         return NULL;
     }
-    
-    memory_block_t* block = (memory_block_t*)ptr - 1;
-    
-    // If the current block is big enough, just return
-    if (block->size >= size) {
+
+    memory_block_t* block = block_from_ptr(ptr);
+    size_t request = size;
+    size_t old_size = block_size(block);
+
+    size = adjust_request_size(size);
+    if (size == 0) {
+        failed_count++;
+        return NULL;  // Can never be satisfied, ptr stays valid
+    }
+
+    // Resize in place: take over a free successor when growing, then give
+    // back whatever is left beyond the new size
+    if (size <= old_size || grow_used_block(block, size)) {
+        trim_used_block(block, size);
+
+        total_allocated = total_allocated - old_size + block_size(block);
+        if (total_allocated > peak_allocated) {
+            peak_allocated = total_allocated;
+        }
+        trace_resize(block, old_size, request);
         return ptr;
     }
-    
+
     // Allocate new block and copy data
-    void* new_ptr = kmalloc(size);
+    void* new_ptr = heap_alloc(request, CALLER);
     if (new_ptr != NULL) {
-        memcpy(new_ptr, ptr, block->size);
+        memcpy(new_ptr, ptr, old_size);
         kfree(ptr);
     }
-    
+
     return new_ptr;
 }
 
@@ -139,18 +785,25 @@ void kfree(void* ptr) {
     if (ptr == NULL) {
         return;
     }
-    
-    memory_block_t* block = (memory_block_t*)ptr - 1;
-    
-    if (block->free) {
+
+    memory_block_t* block = block_from_ptr(ptr);
+
+    if (block_is_free(block)) {
         return;  // Already freed (double-free protection)
     }
-    
-    total_allocated -= block->size;
-    block->free = true;
-    
+
+    trace_free(block);
+    total_allocated -= block_size(block);
+    free_count++;
+    block_mark_free(block);
+
     // Merge with adjacent free blocks
-    merge_blocks(block);
+    block = merge_prev(block);
+    block = merge_next(block);
+
+    if (!release_pool(block)) {
+        insert_free_block(block);
+    }
 }
 
 size_t memory_used(void) {
@@ -158,15 +811,34 @@ size_t memory_used(void) {
 }
 
 size_t memory_free(void) {
-    size_t free_mem = 0;
-    memory_block_t* current = heap_start;
-    
-    while (current != NULL) {
-        if (current->free) {
-            free_mem += current->size;
-        }
-        current = current->next;
+    return free_bytes;
+}
+
+void memory_get_stats(heap_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->heap_size = heap_bytes;
+    stats->used = total_allocated;
+    stats->free = free_bytes;
+    stats->peak_used = peak_allocated;
+    stats->largest_free = largest_free_block();
+    stats->pools = pool_count;
+    stats->free_blocks = free_block_count;
+    stats->alloc_count = alloc_count;
+    stats->free_count = free_count;
+    stats->failed_count = failed_count;
+    stats->reclaim_count = reclaim_count;
+    stats->reclaimed = reclaimed_bytes;
+    // Percentage in 32-bit arithmetic (no 64-bit division in the kernel)
+    size_t outside = free_bytes - stats->largest_free;
+    if (free_bytes == 0) {
+        stats->fragmentation = 0;
+    } else if (outside < 0x1000000) {
+        stats->fragmentation = (uint32_t)(outside * 100 / free_bytes);
+    } else {
+        stats->fragmentation = (uint32_t)(outside / (free_bytes / 100));
     }
-    
-    return free_mem;
+    memcpy(stats->histogram, size_histogram, sizeof(size_histogram));
 }
@@ -0,0 +1,292 @@
+/*
+ * KaiOS - Paging Implementation
+ * Identity-mapped 32-bit paging with 4 MB pages and PAT memory types
+ *
+ * RAM is identity-mapped with 4 MB PSE pages so the whole kernel working
+ * set fits in a handful of TLB entries. Only regions that need per-page
+ * attributes are split into 4 KB page tables: the first 4 MB (NULL page
+ * left unmapped, kernel code and read-only data write-protected, VGA window
+ * write-combining) and whatever later drivers map with paging_map.
+ */
+
+#include "include/kernel/paging.h"
+#include "include/kernel/cpu.h"
+#include "include/kernel/pmm.h"
+#include "include/kernel/idt.h"
+#include "include/kernel/string.h"
+#include "include/drivers/vga.h"
+
+#define ENTRIES_PER_TABLE 1024
+#define PAGE_FRAME_MASK   0xFFFFF000
+#define LARGE_FRAME_MASK  0xFFC00000
+
+// Highest address identity-mapped as RAM (the last 4 MB below 4 GB is
+// left for memory-mapped devices)
+#define RAM_MAP_LIMIT     0xFFC00000
+
+// PAT MSR layout: entries 0-3 are WB, WC, UC-, UC (entry 1 changed from
+// the power-on WT); entries 4-7 mirror them
+#define PAT_VALUE         0x0007010600070106ULL
+
+// Attributes paging_map accepts from callers
+#define PAGE_MAP_FLAGS    (PAGE_WRITE | PAGE_USER | PAGE_CACHE_MASK)
+
+// Kernel image sections (from linker.ld)
+extern "C" uint8_t _text_start[];
+extern "C" uint8_t _rodata_end[];
+
+static uint32_t page_directory[ENTRIES_PER_TABLE] __attribute__((aligned(PAGE_SIZE)));
+
+static bool use_large_pages = false;
+static bool use_pat = false;
+static bool enabled = false;
+
+static inline uintptr_t page_align_down(uintptr_t addr) {
+    return addr & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+static inline void flush_page(uintptr_t virt) {
+    if (enabled) {
+        invlpg(virt);
+    }
+}
+
+static inline void flush_all(void) {
+    if (enabled) {
+        write_cr3(read_cr3());
+    }
+}
+
+// ============================================================================
+// Page tables
+// ============================================================================
+
+// Page table covering virt. With create set, a missing table is allocated
+// and a 4 MB page is split into an equivalent table of 4 KB pages.
+static uint32_t* get_table(uintptr_t virt, bool create) {
+    uint32_t index = virt >> 22;
+    uint32_t pde = page_directory[index];
+
+    if ((pde & PAGE_PRESENT) && !(pde & PAGE_LARGE)) {
+        return (uint32_t*)(uintptr_t)(pde & PAGE_FRAME_MASK);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    uint32_t* table = (uint32_t*)pmm_alloc_pages(0);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    if (pde & PAGE_PRESENT) {
+        uint32_t base = pde & LARGE_FRAME_MASK;
+        uint32_t flags = pde & (PAGE_WRITE | PAGE_USER | PAGE_CACHE_MASK);
+        if (pde & PAGE_PAT_LARGE) {
+            flags |= PAGE_PAT;
+        }
+        for (uint32_t i = 0; i < ENTRIES_PER_TABLE; i++) {
+            table[i] = (base + i * PAGE_SIZE) | flags | PAGE_PRESENT;
+        }
+    } else {
+        memset(table, 0, PAGE_SIZE);
+    }
+
+    // Permissions and memory type are decided by the table entries
+    page_directory[index] = (uint32_t)(uintptr_t)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    return table;
+}
+
+// Drop the page table behind a directory entry, if any
+static void release_table(uint32_t index) {
+    uint32_t pde = page_directory[index];
+    if ((pde & PAGE_PRESENT) && !(pde & PAGE_LARGE)) {
+        pmm_free_pages(pde & PAGE_FRAME_MASK, 0);
+    }
+}
+
+// ============================================================================
+// Mapping API
+// ============================================================================
+
+bool paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint32_t flags) {
+    size += virt & (PAGE_SIZE - 1);
+    virt = page_align_down(virt);
+    phys = page_align_down(phys);
+
+    flags &= PAGE_MAP_FLAGS;
+    if ((flags & PAGE_CACHE_MASK) == PAGE_CACHE_WC && !use_pat) {
+        flags |= PAGE_CACHE_UC;  // Without PAT the closest safe type is UC
+    }
+
+    while (size > 0) {
+        uint32_t index = virt >> 22;
+
+        if (use_large_pages && ((virt | phys) & (LARGE_PAGE_SIZE - 1)) == 0 && size >= LARGE_PAGE_SIZE) {
+            bool had_table = (page_directory[index] & (PAGE_PRESENT | PAGE_LARGE)) == PAGE_PRESENT;
+            release_table(index);
+            page_directory[index] = (uint32_t)phys | flags | PAGE_PRESENT | PAGE_LARGE;
+            if (had_table) {
+                flush_all();
+            } else {
+                flush_page(virt);
+            }
+
+            virt += LARGE_PAGE_SIZE;
+            phys += LARGE_PAGE_SIZE;
+            size -= LARGE_PAGE_SIZE;
+            if (virt == 0) break;  // Wrapped past 4 GB
+            continue;
+        }
+
+        uint32_t* table = get_table(virt, true);
+        if (table == NULL) {
+            return false;
+        }
+        table[(virt >> 12) & (ENTRIES_PER_TABLE - 1)] = (uint32_t)phys | flags | PAGE_PRESENT;
+        flush_page(virt);
+
+        virt += PAGE_SIZE;
+        phys += PAGE_SIZE;
+        size = (size > PAGE_SIZE) ? size - PAGE_SIZE : 0;
+        if (virt == 0) break;
+    }
+    return true;
+}
+
+void paging_unmap(uintptr_t virt, size_t size) {
+    size += virt & (PAGE_SIZE - 1);
+    virt = page_align_down(virt);
+
+    while (size > 0) {
+        uint32_t index = virt >> 22;
+        uint32_t pde = page_directory[index];
+
+        if ((virt & (LARGE_PAGE_SIZE - 1)) == 0 && size >= LARGE_PAGE_SIZE) {
+            // Whole directory entry goes away
+            release_table(index);
+            page_directory[index] = 0;
+            if (pde & PAGE_LARGE) {
+                flush_page(virt);
+            } else if (pde & PAGE_PRESENT) {
+                flush_all();
+            }
+
+            virt += LARGE_PAGE_SIZE;
+            size -= LARGE_PAGE_SIZE;
+        } else {
+            uint32_t* table = get_table(virt, (pde & PAGE_PRESENT) != 0);
+            if (table != NULL) {
+                table[(virt >> 12) & (ENTRIES_PER_TABLE - 1)] = 0;
+                flush_page(virt);
+            }
+
+            virt += PAGE_SIZE;
+            size = (size > PAGE_SIZE) ? size - PAGE_SIZE : 0;
+        }
+        if (virt == 0) break;  // Wrapped past 4 GB
+    }
+}
+
+uintptr_t paging_translate(uintptr_t virt) {
+    uint32_t pde = page_directory[virt >> 22];
+    if (!(pde & PAGE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PAGE_LARGE) {
+        return (pde & LARGE_FRAME_MASK) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+
+    uint32_t* table = (uint32_t*)(uintptr_t)(pde & PAGE_FRAME_MASK);
+    uint32_t pte = table[(virt >> 12) & (ENTRIES_PER_TABLE - 1)];
+    if (!(pte & PAGE_PRESENT)) {
+        return 0;
+    }
+    return (pte & PAGE_FRAME_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+// ============================================================================
+// Page faults
+// ============================================================================
+
+static void page_fault_handler(registers_t* regs) {
+    char num_str[12];
+    uint32_t addr = read_cr2();
+
+    vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    vga_writestring("Page fault: ");
+    vga_writestring((regs->err_code & 0x2) ? "write to " : "read from ");
+    vga_writestring((regs->err_code & 0x1) ? "protected page 0x" : "unmapped page 0x");
+    utoa(addr, num_str, 16);
+    vga_writestring(num_str);
+    vga_writestring(" at eip 0x");
+    utoa(regs->eip, num_str, 16);
+    vga_writestring(num_str);
+    vga_writestring("\n");
+
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+// ============================================================================
+// Initialization
+// ============================================================================
+
+void paging_init(multiboot_info_t* mboot_info) {
+    use_large_pages = cpu_has_feature(CPU_FEATURE_PSE);
+    use_pat = cpu_has_feature(CPU_FEATURE_PAT | CPU_FEATURE_MSR);
+    memset(page_directory, 0, sizeof(page_directory));
+
+    // Identity-map RAM (at least the first 4 MB, which holds the kernel)
+    uintptr_t ram_end = pmm_highest_address();
+    if (ram_end > RAM_MAP_LIMIT) {
+        ram_end = RAM_MAP_LIMIT;
+    }
+    ram_end = (ram_end + LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+    if (ram_end < LARGE_PAGE_SIZE) {
+        ram_end = LARGE_PAGE_SIZE;
+    }
+    if (!paging_map(0, 0, ram_end, PAGE_WRITE)) {
+        return;  // No memory for page tables, stay unpaged
+    }
+
+    // Trap NULL pointer dereferences
+    paging_unmap(0, PAGE_SIZE);
+
+    // Kernel code and read-only data (.data starts on a fresh page, so
+    // rounding the end up does not cover writable data)
+    uintptr_t text_start = (uintptr_t)_text_start;
+    paging_map(text_start, text_start, (uintptr_t)_rodata_end - text_start, 0);
+
+    // Framebuffers are written front to back and never read back, which is
+    // exactly what write-combining is for
+    paging_map(VGA_FRAMEBUFFER, VGA_FRAMEBUFFER, VGA_FRAMEBUFFER_SIZE, PAGE_WRITE | PAGE_CACHE_WC);
+    if (mboot_info != NULL && (mboot_info->flags & MULTIBOOT_INFO_FRAMEBUFFER) &&
+        mboot_info->framebuffer_addr < RAM_MAP_LIMIT) {
+        uintptr_t fb = (uintptr_t)mboot_info->framebuffer_addr;
+        size_t fb_size = mboot_info->framebuffer_pitch * mboot_info->framebuffer_height;
+        paging_map(fb, fb, fb_size, PAGE_WRITE | PAGE_CACHE_WC);
+    }
+
+    if (use_pat) {
+        wrmsr(MSR_PAT, PAT_VALUE);
+    }
+    if (use_large_pages) {
+        write_cr4(read_cr4() | CR4_PSE);
+    }
+
+    register_interrupt_handler(14, page_fault_handler);
+
+    write_cr3((uint32_t)(uintptr_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+    enabled = true;
+}
+
+bool paging_enabled(void) {
+    return enabled;
+}
+
+bool paging_write_combining(void) {
+    return use_pat;
+}
@@ -0,0 +1,301 @@
+/*
+ * KaiOS - Physical Memory Manager Implementation
+ * Buddy-system page-frame allocator over the multiboot memory map
+ *
+ * Every usable page above the kernel image is owned by exactly one free
+ * block of 2^order pages, kept on a per-order free list threaded through
+ * the free pages themselves. A byte per frame records whether the frame
+ * heads a free block and of which order, which is all that is needed to
+ * find and merge a buddy in O(1) per level.
+ */
+
+#include "include/kernel/pmm.h"
+#include "include/kernel/string.h"
+
+// Frame info byte: FRAME_FREE marks the head of a free block, the low
+// bits hold the block order
+#define FRAME_FREE       0x80
+
+// Never manage memory above 4 GB (no PAE)
+#define PMM_ADDR_LIMIT   0xFFFFF000ULL
+
+// Up to this many boot structures are kept out of the free lists
+#define PMM_MAX_RESERVED 4
+
+// End of the kernel image (from linker.ld)
+extern "C" uint8_t _kernel_end[];
+
+// Free block link, stored in the first bytes of the free block
+typedef struct pmm_free_block {
+    struct pmm_free_block* next;
+    struct pmm_free_block* prev;
+} pmm_free_block_t;
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} pmm_range_t;
+
+static pmm_free_block_t* free_lists[PMM_ORDER_COUNT];
+static uint8_t* frame_info = NULL;
+static size_t frame_count = 0;
+static size_t total_pages = 0;
+static size_t free_pages = 0;
+static uintptr_t highest_address = 0;
+
+static pmm_range_t reserved[PMM_MAX_RESERVED];
+static int reserved_count = 0;
+
+static inline uintptr_t page_align_up(uintptr_t addr) {
+    return (addr + PMM_PAGE_SIZE - 1) & ~(uintptr_t)(PMM_PAGE_SIZE - 1);
+}
+
+static inline uintptr_t page_align_down(uintptr_t addr) {
+    return addr & ~(uintptr_t)(PMM_PAGE_SIZE - 1);
+}
+
+// ============================================================================
+// Free lists
+// ============================================================================
+
+static void list_push(uint32_t order, size_t frame) {
+    pmm_free_block_t* block = (pmm_free_block_t*)(frame << PMM_PAGE_SHIFT);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (free_lists[order] != NULL) {
+        free_lists[order]->prev = block;
+    }
+    free_lists[order] = block;
+    frame_info[frame] = FRAME_FREE | order;
+}
+
+static void list_remove(uint32_t order, size_t frame) {
+    pmm_free_block_t* block = (pmm_free_block_t*)(frame << PMM_PAGE_SHIFT);
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    frame_info[frame] = 0;
+}
+
+// Return a block to the free lists, merging with free buddies
+static void free_block(size_t frame, uint32_t order) {
+    while (order < PMM_MAX_ORDER) {
+        size_t buddy = frame ^ ((size_t)1 << order);
+        if (buddy >= frame_count || frame_info[buddy] != (FRAME_FREE | order)) {
+            break;
+        }
+        list_remove(order, buddy);
+        frame &= ~((size_t)1 << order);
+        order++;
+    }
+    list_push(order, frame);
+}
+
+// ============================================================================
+// Initialization
+// ============================================================================
+
+static void reserve_range(uintptr_t start, uintptr_t end) {
+    if (reserved_count >= PMM_MAX_RESERVED || end <= start) {
+        return;
+    }
+    reserved[reserved_count].start = page_align_down(start);
+    reserved[reserved_count].end = page_align_up(end);
+    reserved_count++;
+}
+
+// Lowest reserved range overlapping [start, end), or NULL
+static pmm_range_t* first_reserved_in(uintptr_t start, uintptr_t end) {
+    pmm_range_t* first = NULL;
+    for (int i = 0; i < reserved_count; i++) {
+        if (reserved[i].start < end && reserved[i].end > start) {
+            if (first == NULL || reserved[i].start < first->start) {
+                first = &reserved[i];
+            }
+        }
+    }
+    return first;
+}
+
+// Hand the pages of [start, end) to the free lists as maximal aligned blocks
+static void add_free_range(uintptr_t start, uintptr_t end) {
+    size_t frame = start >> PMM_PAGE_SHIFT;
+    size_t end_frame = end >> PMM_PAGE_SHIFT;
+
+    while (frame < end_frame) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (frame & (((size_t)2 << order) - 1)) == 0 &&
+               frame + ((size_t)2 << order) <= end_frame) {
+            order++;
+        }
+        free_block(frame, order);
+        total_pages += (size_t)1 << order;
+        free_pages += (size_t)1 << order;
+        frame += (size_t)1 << order;
+    }
+}
+
+// Add a usable region, skipping boot structures inside it
+static void add_usable_range(uintptr_t start, uintptr_t end) {
+    while (start < end) {
+        pmm_range_t* r = first_reserved_in(start, end);
+        if (r == NULL) {
+            add_free_range(start, end);
+            return;
+        }
+        if (r->start > start) {
+            add_free_range(start, r->start);
+        }
+        start = r->end;
+    }
+}
+
+typedef void (*range_callback_t)(uintptr_t start, uintptr_t end);
+
+// Walk the usable regions of the memory map, clipped to [floor, 4 GB)
+static void for_each_usable(multiboot_info_t* mboot_info, uintptr_t floor, range_callback_t fn) {
+    if (mboot_info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uintptr_t pos = mboot_info->mmap_addr;
+        uintptr_t end = pos + mboot_info->mmap_length;
+
+        while (pos < end) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)pos;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->addr < PMM_ADDR_LIMIT) {
+                uint64_t region_end = entry->addr + entry->len;
+                if (region_end > PMM_ADDR_LIMIT) region_end = PMM_ADDR_LIMIT;
+
+                uintptr_t s = page_align_up((uintptr_t)entry->addr);
+                uintptr_t e = page_align_down((uintptr_t)region_end);
+                if (s < floor) s = floor;
+                if (s < e) fn(s, e);
+            }
+            pos += entry->size + sizeof(entry->size);
+        }
+    } else if (mboot_info->flags & MULTIBOOT_INFO_MEMORY) {
+        // No map: everything from 1 MB up to mem_upper is usable
+        uintptr_t s = 0x100000;
+        uintptr_t e = page_align_down(s + (uintptr_t)mboot_info->mem_upper * 1024);
+        if (s < floor) s = floor;
+        if (s < e) fn(s, e);
+    }
+}
+
+static void track_highest(uintptr_t start, uintptr_t end) {
+    (void)start;
+    if (end > highest_address) {
+        highest_address = end;
+    }
+}
+
+void pmm_init(multiboot_info_t* mboot_info) {
+    memset(free_lists, 0, sizeof(free_lists));
+    total_pages = 0;
+    free_pages = 0;
+    highest_address = 0;
+    reserved_count = 0;
+
+    if (mboot_info == NULL) {
+        return;
+    }
+
+    // Keep the bootloader's structures intact
+    reserve_range((uintptr_t)mboot_info, (uintptr_t)mboot_info + sizeof(multiboot_info_t));
+    if (mboot_info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        reserve_range(mboot_info->mmap_addr, mboot_info->mmap_addr + mboot_info->mmap_length);
+    }
+    if (mboot_info->flags & MULTIBOOT_INFO_CMDLINE) {
+        const char* cmdline = (const char*)(uintptr_t)mboot_info->cmdline;
+        reserve_range(mboot_info->cmdline, mboot_info->cmdline + strlen(cmdline) + 1);
+    }
+
+    uintptr_t kernel_end = page_align_up((uintptr_t)_kernel_end);
+
+    // Size the frame table from the highest usable address
+    for_each_usable(mboot_info, kernel_end, track_highest);
+    if (highest_address == 0) {
+        return;  // No usable memory above the kernel
+    }
+    frame_count = highest_address >> PMM_PAGE_SHIFT;
+
+    // Place the frame table right after the kernel, clear of boot structures
+    uintptr_t table = kernel_end;
+    for (pmm_range_t* r; (r = first_reserved_in(table, table + frame_count)) != NULL; ) {
+        table = r->end;
+    }
+    frame_info = (uint8_t*)table;
+    memset(frame_info, 0, frame_count);
+    reserve_range(table, table + frame_count);
+
+    for_each_usable(mboot_info, kernel_end, add_usable_range);
+}
+
+// ============================================================================
+// Allocation
+// ============================================================================
+
+uintptr_t pmm_alloc_pages(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    // Find the smallest non-empty list that can satisfy the request
+    uint32_t current = order;
+    while (current <= PMM_MAX_ORDER && free_lists[current] == NULL) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        return 0;  // Out of memory
+    }
+
+    size_t frame = (uintptr_t)free_lists[current] >> PMM_PAGE_SHIFT;
+    list_remove(current, frame);
+
+    // Split, returning the upper halves to the free lists
+    while (current > order) {
+        current--;
+        list_push(current, frame + ((size_t)1 << current));
+    }
+
+    frame_info[frame] = order;
+    free_pages -= (size_t)1 << order;
+    return (uintptr_t)frame << PMM_PAGE_SHIFT;
+}
+
+void pmm_free_pages(uintptr_t addr, uint32_t order) {
+    size_t frame = addr >> PMM_PAGE_SHIFT;
+    if (addr == 0 || order > PMM_MAX_ORDER || frame >= frame_count) {
+        return;
+    }
+    if (frame_info[frame] & FRAME_FREE) {
+        return;  // Already freed (double-free protection)
+    }
+
+    free_pages += (size_t)1 << order;
+    free_block(frame, order);
+}
+
+uint32_t pmm_order_for_size(size_t size) {
+    uint32_t order = 0;
+    while (order <= PMM_MAX_ORDER && ((size_t)PMM_PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;  // PMM_MAX_ORDER + 1 if no block is big enough
+}
+
+size_t pmm_total_pages(void) {
+    return total_pages;
+}
+
+size_t pmm_free_page_count(void) {
+    return free_pages;
+}
+
+uintptr_t pmm_highest_address(void) {
+    return highest_address;
+}
@@ -0,0 +1,452 @@
+/*
+ * KaiOS - Formatted Output Implementation
+ * printf engine with buffered console, serial and log sinks
+ *
+ * Numbers are converted without division: decimal digits come from
+ * multiplying by a fixed-point reciprocal of 10, other bases by shifting.
+ * 64-bit values need no libgcc helpers either.
+ */
+
+#include "include/kernel/printf.h"
+#include "include/kernel/string.h"
+#include "include/drivers/vga.h"
+#include "include/drivers/serial.h"
+
+// Sinks a formatted stream is flushed to (none = string output)
+#define SINK_VGA     0x1
+#define SINK_SERIAL  0x2
+#define SINK_LOG     0x4
+
+// Format flags
+#define FLAG_LEFT    0x01
+#define FLAG_ZERO    0x02
+#define FLAG_PLUS    0x04
+#define FLAG_SPACE   0x08
+#define FLAG_PREFIX  0x10
+#define FLAG_UPPER   0x20
+
+typedef struct {
+    char* buffer;
+    size_t capacity;
+    size_t pos;
+    size_t total;           // Characters produced, including any dropped
+    uint32_t sinks;
+} output_t;
+
+static char log_ring[KLOG_SIZE];
+static uint32_t log_written = 0;
+
+// ============================================================================
+// Sinks
+// ============================================================================
+
+static void log_append(const char* data, size_t len) {
+    // Only the newest KLOG_SIZE bytes can survive
+    if (len > KLOG_SIZE) {
+        data += len - KLOG_SIZE;
+        log_written += len - KLOG_SIZE;
+        len = KLOG_SIZE;
+    }
+
+    uint32_t start = log_written & (KLOG_SIZE - 1);
+    size_t first = KLOG_SIZE - start;
+    if (first > len) first = len;
+
+    memcpy(log_ring + start, data, first);
+    memcpy(log_ring, data + first, len - first);
+    log_written += len;
+}
+
+static void output_flush(output_t* out) {
+    if (out->pos == 0 || out->sinks == 0) {
+        return;
+    }
+    if (out->sinks & SINK_VGA) vga_write(out->buffer, out->pos);
+    if (out->sinks & SINK_SERIAL) serial_write(out->buffer, out->pos);
+    if (out->sinks & SINK_LOG) log_append(out->buffer, out->pos);
+    out->pos = 0;
+}
+
+static inline void output_char(output_t* out, char c) {
+    out->total++;
+    if (out->pos == out->capacity) {
+        if (out->sinks == 0) {
+            return;     // String output: truncate
+        }
+        output_flush(out);
+    }
+    out->buffer[out->pos++] = c;
+}
+
+static void output_repeat(output_t* out, char c, int count) {
+    while (count-- > 0) {
+        output_char(out, c);
+    }
+}
+
+static void output_string(output_t* out, const char* str, size_t len) {
+    while (len > 0) {
+        if (out->pos == out->capacity) {
+            if (out->sinks == 0) {
+                out->total += len;
+                return;
+            }
+            output_flush(out);
+        }
+
+        size_t chunk = out->capacity - out->pos;
+        if (chunk > len) chunk = len;
+        memcpy(out->buffer + out->pos, str, chunk);
+        out->pos += chunk;
+        out->total += chunk;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+// ============================================================================
+// Digit conversion
+// ============================================================================
+
+// value / 10 for any 32-bit value: multiply by ceil(2^35 / 10), shift back
+static inline uint32_t div10_32(uint32_t value) {
+    return (uint32_t)(((uint64_t)value * 0xCCCCCCCDU) >> 35);
+}
+
+// High 64 bits of a 64x64-bit product, from 32-bit partial products
+static inline uint64_t mul_high_64(uint64_t a, uint64_t b) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t hi_hi = a_hi * b_hi;
+
+    uint64_t middle = (lo_lo >> 32) + (uint32_t)lo_hi + (uint32_t)hi_lo;
+    return hi_hi + (lo_hi >> 32) + (hi_lo >> 32) + (middle >> 32);
+}
+
+// value / 10 for any 64-bit value (reciprocal 0xCCCCCCCCCCCCCCCD / 2^67)
+static inline uint64_t div10_64(uint64_t value) {
+    return mul_high_64(value, 0xCCCCCCCCCCCCCCCDULL) >> 3;
+}
+
+// Write digits backwards ending at end; returns the first digit
+static char* convert_decimal(uint64_t value, char* end) {
+    char* p = end;
+
+    while (value > 0xFFFFFFFFULL) {
+        uint64_t quotient = div10_64(value);
+        *--p = '0' + (char)(value - quotient * 10);
+        value = quotient;
+    }
+
+    uint32_t small = (uint32_t)value;
+    do {
+        uint32_t quotient = div10_32(small);
+        *--p = '0' + (char)(small - quotient * 10);
+        small = quotient;
+    } while (small != 0);
+
+    return p;
+}
+
+static char* convert_power_of_two(uint64_t value, char* end, uint32_t shift, bool upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    uint32_t mask = (1U << shift) - 1;
+    char* p = end;
+
+    do {
+        *--p = digits[(uint32_t)value & mask];
+        value >>= shift;
+    } while (value != 0);
+
+    return p;
+}
+
+// ============================================================================
+// Formatter
+// ============================================================================
+
+static void format_number(output_t* out, uint64_t value, bool negative, char base,
+                          uint32_t flags, int width, int precision) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start;
+
+    if (base == 'd') {
+        start = convert_decimal(value, end);
+    } else if (base == 'o') {
+        start = convert_power_of_two(value, end, 3, false);
+    } else {
+        start = convert_power_of_two(value, end, 4, (flags & FLAG_UPPER) != 0);
+    }
+
+    int length = (int)(end - start);
+    if (precision == 0 && value == 0) {
+        length = 0;     // "%.0d" of zero prints nothing
+    }
+
+    // Sign or base prefix
+    char prefix[3];
+    int prefix_length = 0;
+    if (negative) {
+        prefix[prefix_length++] = '-';
+    } else if (flags & FLAG_PLUS) {
+        prefix[prefix_length++] = '+';
+    } else if (flags & FLAG_SPACE) {
+        prefix[prefix_length++] = ' ';
+    }
+    if (flags & FLAG_PREFIX) {
+        if (base == 'x' && value != 0) {
+            prefix[prefix_length++] = '0';
+            prefix[prefix_length++] = (flags & FLAG_UPPER) ? 'X' : 'x';
+        } else if (base == 'o' && precision <= length && (length == 0 || *start != '0')) {
+            prefix[prefix_length++] = '0';     // Octal: force a leading zero
+        }
+    }
+
+    int zeros = precision > length ? precision - length : 0;
+    if ((flags & FLAG_ZERO) && !(flags & FLAG_LEFT) && precision < 0) {
+        int fill = width - prefix_length - length;
+        if (fill > zeros) zeros = fill;
+    }
+
+    int padding = width - prefix_length - zeros - length;
+    if (!(flags & FLAG_LEFT)) output_repeat(out, ' ', padding);
+    output_string(out, prefix, prefix_length);
+    output_repeat(out, '0', zeros);
+    output_string(out, start, length);
+    if (flags & FLAG_LEFT) output_repeat(out, ' ', padding);
+}
+
+static void format_output(output_t* out, const char* format, va_list args) {
+    while (*format != '\0') {
+        // Copy literal text up to the next conversion in one go
+        const char* literal = format;
+        while (*format != '\0' && *format != '%') {
+            format++;
+        }
+        output_string(out, literal, format - literal);
+        if (*format == '\0') {
+            break;
+        }
+        format++;
+
+        // Flags
+        uint32_t flags = 0;
+        for (;; format++) {
+            if (*format == '-') flags |= FLAG_LEFT;
+            else if (*format == '0') flags |= FLAG_ZERO;
+            else if (*format == '+') flags |= FLAG_PLUS;
+            else if (*format == ' ') flags |= FLAG_SPACE;
+            else if (*format == '#') flags |= FLAG_PREFIX;
+            else break;
+        }
+
+        // Width
+        int width = 0;
+        if (*format == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            format++;
+        } else {
+            while (isdigit(*format)) {
+                width = width * 10 + (*format++ - '0');
+            }
+        }
+
+        // Precision
+        int precision = -1;
+        if (*format == '.') {
+            format++;
+            precision = 0;
+            if (*format == '*') {
+                precision = va_arg(args, int);
+                if (precision < 0) precision = -1;
+                format++;
+            } else {
+                while (isdigit(*format)) {
+                    precision = precision * 10 + (*format++ - '0');
+                }
+            }
+        }
+
+        // Length
+        int length = 0;     // 0 = int, 1 = long, 2 = long long, 3 = size_t,
+                            // 4 = short, 5 = char
+        if (*format == 'h') {
+            format++;
+            length = 4;
+            if (*format == 'h') {
+                format++;
+                length = 5;
+            }
+        } else if (*format == 'l') {
+            format++;
+            length = 1;
+            if (*format == 'l') {
+                format++;
+                length = 2;
+            }
+        } else if (*format == 'z') {
+            format++;
+            length = 3;
+        }
+
+        char conversion = *format;
+        if (conversion == '\0') {
+            break;
+        }
+        format++;
+
+        switch (conversion) {
+        case 'd':
+        case 'i': {
+            int64_t value;
+            if (length == 2) value = va_arg(args, long long);
+            else if (length == 1) value = va_arg(args, long);
+            else if (length == 3) value = va_arg(args, ssize_t);
+            else if (length == 4) value = (short)va_arg(args, int);
+            else if (length == 5) value = (signed char)va_arg(args, int);
+            else value = va_arg(args, int);
+
+            bool negative = value < 0;
+            uint64_t magnitude = negative ? 0 - (uint64_t)value : (uint64_t)value;
+            format_number(out, magnitude, negative, 'd', flags, width, precision);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+            uint64_t value;
+            if (length == 2) value = va_arg(args, unsigned long long);
+            else if (length == 1) value = va_arg(args, unsigned long);
+            else if (length == 3) value = va_arg(args, size_t);
+            else if (length == 4) value = (unsigned short)va_arg(args, unsigned int);
+            else if (length == 5) value = (unsigned char)va_arg(args, unsigned int);
+            else value = va_arg(args, unsigned int);
+
+            // Sign flags only apply to signed conversions
+            flags &= ~(FLAG_PLUS | FLAG_SPACE);
+            if (conversion == 'X') flags |= FLAG_UPPER;
+            char base = conversion == 'u' ? 'd' : (conversion == 'o' ? 'o' : 'x');
+            format_number(out, value, false, base, flags, width, precision);
+            break;
+        }
+        case 'p': {
+            uintptr_t value = (uintptr_t)va_arg(args, void*);
+            output_string(out, "0x", 2);
+            format_number(out, value, false, 'x', FLAG_ZERO, sizeof(void*) * 2, -1);
+            break;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            if (!(flags & FLAG_LEFT)) output_repeat(out, ' ', width - 1);
+            output_char(out, c);
+            if (flags & FLAG_LEFT) output_repeat(out, ' ', width - 1);
+            break;
+        }
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            if (str == NULL) str = "(null)";
+
+            size_t len = 0;
+            if (precision >= 0) {
+                while (len < (size_t)precision && str[len] != '\0') len++;
+            } else {
+                len = strlen(str);
+            }
+
+            int padding = width - (int)len;
+            if (!(flags & FLAG_LEFT)) output_repeat(out, ' ', padding);
+            output_string(out, str, len);
+            if (flags & FLAG_LEFT) output_repeat(out, ' ', padding);
+            break;
+        }
+        case '%':
+            output_char(out, '%');
+            break;
+        default:
+            // Unknown conversion: print it verbatim
+            output_char(out, '%');
+            output_char(out, conversion);
+            break;
+        }
+    }
+}
+
+// ============================================================================
+// Entry points
+// ============================================================================
+
+int kvsnprintf(char* buffer, size_t size, const char* format_string, va_list args) {
+    output_t out;
+    out.buffer = buffer;
+    out.capacity = size ? size - 1 : 0;
+    out.pos = 0;
+    out.total = 0;
+    out.sinks = 0;
+
+    format_output(&out, format_string, args);
+    if (size > 0) {
+        buffer[out.pos] = '\0';
+    }
+    return (int)out.total;
+}
+
+int ksnprintf(char* buffer, size_t size, const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+    int result = kvsnprintf(buffer, size, format_string, args);
+    va_end(args);
+    return result;
+}
+
+static int print_to_sinks(uint32_t sinks, const char* format_string, va_list args) {
+    char buffer[KPRINTF_BUFFER_SIZE];
+    output_t out;
+    out.buffer = buffer;
+    out.capacity = sizeof(buffer);
+    out.pos = 0;
+    out.total = 0;
+    out.sinks = sinks;
+
+    format_output(&out, format_string, args);
+    output_flush(&out);
+    return (int)out.total;
+}
+
+int kprintf(const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+    int result = print_to_sinks(SINK_VGA | SINK_SERIAL, format_string, args);
+    va_end(args);
+    return result;
+}
+
+int klog(const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+    int result = print_to_sinks(SINK_LOG | SINK_SERIAL, format_string, args);
+    va_end(args);
+    return result;
+}
+
+size_t klog_read(char* out, size_t size) {
+    size_t available = log_written < KLOG_SIZE ? log_written : KLOG_SIZE;
+    if (size > available) size = available;
+
+    uint32_t start = (log_written - size) & (KLOG_SIZE - 1);
+    size_t first = KLOG_SIZE - start;
+    if (first > size) first = size;
+
+    memcpy(out, log_ring + start, first);
+    memcpy(out + first, log_ring, size - first);
+    return size;
+}
@@ -6,6 +6,8 @@
 #include "include/kernel/shell.h"
 #include "include/kernel/fs.h"
 #include "include/kernel/memory.h"
+#include "include/kernel/slab.h"
+#include "include/kernel/printf.h"
 #include "include/kernel/string.h"
 #include "include/drivers/vga.h"
 #include "include/drivers/keyboard.h"
@@ -16,6 +18,9 @@ static size_t input_pos = 0;
 static char* argv[SHELL_MAX_ARGS];
 static int argc = 0;
 
+// Per-command scratch arena
+static arena_t command_arena;
+
 // Simple uptime counter (ticks)
 static uint32_t uptime_ticks = 0;
 
@@ -30,6 +35,11 @@ static inline void outb(uint16_t port, uint8_t value) {
 void shell_init(void) {
     input_pos = 0;
     memset(input_buffer, 0, SHELL_MAX_INPUT);
+    arena_init(&command_arena, 0);
+}
+
+arena_t* shell_arena(void) {
+    return &command_arena;
 }
 
 static void print_prompt(void) {
@@ -130,6 +140,14 @@ void shell_process_command(char* input) {
         cmd_mv(argc, argv);
     } else if (strcmp(argv[0], "free") == 0) {
         cmd_free(argc, argv);
+    } else if (strcmp(argv[0], "heapstat") == 0) {
+        cmd_heapstat(argc, argv);
+    } else if (strcmp(argv[0], "kmtrace") == 0) {
+        cmd_kmtrace(argc, argv);
+    } else if (strcmp(argv[0], "slabinfo") == 0) {
+        cmd_slabinfo(argc, argv);
+    } else if (strcmp(argv[0], "dmesg") == 0) {
+        cmd_dmesg(argc, argv);
     } else if (strcmp(argv[0], "uname") == 0) {
         cmd_uname(argc, argv);
     } else if (strcmp(argv[0], "date") == 0) {
@@ -171,6 +189,7 @@ void shell_run(void) {
             
             if (input_pos > 0) {
                 shell_process_command(input_buffer);
+                arena_reset(&command_arena);
             }
             
             input_pos = 0;
@@ -226,6 +245,10 @@ void cmd_help(int argc, char** argv) {
     vga_writestring("  mv         - Move/rename a file\n");
     vga_writestring("  sync       - Save filesystem to disk\n");
     vga_writestring("  free       - Show memory usage\n");
+    vga_writestring("  heapstat   - Show heap statistics\n");
+    vga_writestring("  kmtrace    - Show top allocation call sites\n");
+    vga_writestring("  slabinfo   - Show object cache usage\n");
+    vga_writestring("  dmesg      - Show kernel log\n");
     vga_writestring("  uname      - Show system info\n");
     vga_writestring("  date       - Show current date\n");
     vga_writestring("  uptime     - Show system uptime\n");
@@ -279,11 +302,7 @@ void cmd_ls(int argc, char** argv) {
         // Show file size for files
         if (children[i]->type == FS_FILE) {
             vga_set_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
-            vga_writestring(" (");
-            char size_str[16];
-            utoa(children[i]->size, size_str, 10);
-            vga_writestring(size_str);
-            vga_writestring(" bytes)");
+            kprintf(" (%u bytes)", children[i]->size);
         }
         
         vga_writestring("\n");
@@ -375,39 +394,42 @@ void cmd_cat(int argc, char** argv) {
         return;
     }
     
-    fs_node_t* file = fs_find(argv[1]);
-    if (file == NULL) {
+    fs_node_t* node = fs_resolve_path(argv[1]);
+    if (node == NULL) {
         vga_writestring("cat: ");
         vga_writestring(argv[1]);
         vga_writestring(": No such file\n");
         return;
     }
     
-    if (file->type == FS_DIRECTORY) {
+    if (node->type == FS_DIRECTORY) {
         vga_writestring("cat: ");
         vga_writestring(argv[1]);
         vga_writestring(": Is a directory\n");
         return;
     }
     
-    if (file->size == 0) {
-        return;  // Empty file
+    fs_file_t* file = fs_open(argv[1], FS_O_READ);
+    if (file == NULL) {
+        vga_writestring("cat: ");
+        vga_writestring(argv[1]);
+        vga_writestring(": Cannot open\n");
+        return;
     }
     
-    char* buffer = (char*)kmalloc(file->size + 1);
-    if (buffer == NULL) {
-        vga_writestring("cat: out of memory\n");
-        return;
+    // Print straight from the file's storage, one extent at a time
+    const uint8_t* data;
+    size_t length;
+    char last = '\n';
+    while ((data = fs_view(file, &length)) != NULL) {
+        vga_write((const char*)data, length);
+        last = (char)data[length - 1];
     }
+    fs_close(file);
     
-    fs_read(file, buffer, file->size, 0);
-    buffer[file->size] = '\0';
-    vga_writestring(buffer);
-    if (buffer[file->size - 1] != '\n') {
+    if (last != '\n') {
         vga_putchar('\n');
     }
-    
-    kfree(buffer);
 }
 
 void cmd_write(int argc, char** argv) {
@@ -466,17 +488,74 @@ void cmd_mv(int argc, char** argv) {
 }
 
 void cmd_free(int argc, char** argv) {
-    char buffer[32];
+    kprintf("Memory Usage:\n"
+            "  Used: %u bytes\n"
+            "  Free: %u bytes\n", memory_used(), memory_free());
+}
+
+void cmd_heapstat(int argc, char** argv) {
+    heap_stats_t stats;
+    memory_get_stats(&stats);
+    
+    kprintf("Heap size:     %u bytes in %u pool(s)\n", stats.heap_size, stats.pools);
+    kprintf("Used:          %u bytes (peak %u)\n", stats.used, stats.peak_used);
+    kprintf("Free:          %u bytes in %u block(s)\n", stats.free, stats.free_blocks);
+    kprintf("Largest free:  %u bytes\n", stats.largest_free);
+    kprintf("Fragmentation: %u%%\n", stats.fragmentation);
+    kprintf("Allocations:   %u  frees: %u  failed: %u\n",
+            stats.alloc_count, stats.free_count, stats.failed_count);
+    kprintf("Reclaimed:     %u bytes in %u shrinker pass(es)\n", stats.reclaimed, stats.reclaim_count);
+    
+    vga_writestring("Request sizes:\n");
+    for (int i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        if (stats.histogram[i] == 0) continue;
+        
+        if (i == HEAP_HIST_BUCKETS - 1) {
+            kprintf("  >%-8u%u\n", 1U << (HEAP_HIST_MIN_LOG2 + i - 1), stats.histogram[i]);
+        } else {
+            kprintf("  <=%-8u%u\n", 1U << (HEAP_HIST_MIN_LOG2 + i), stats.histogram[i]);
+        }
+    }
+}
+
+void cmd_kmtrace(int argc, char** argv) {
+#ifdef KMALLOC_TRACE
+    kmalloc_site_t sites[16];
+    size_t max = 10;
+    if (argc > 1) {
+        int n = atoi(argv[1]);
+        if (n > 0) max = (size_t)n;
+    }
+    if (max > 16) max = 16;
+    
+    size_t count = memory_trace_top(sites, max);
+    vga_writestring("Call site   Live bytes  Live blocks  Total allocs\n");
     
-    vga_writestring("Memory Usage:\n");
-    vga_writestring("  Used: ");
-    utoa(memory_used(), buffer, 10);
-    vga_writestring(buffer);
-    vga_writestring(" bytes\n");
-    vga_writestring("  Free: ");
-    utoa(memory_free(), buffer, 10);
-    vga_writestring(buffer);
-    vga_writestring(" bytes\n");
+    for (size_t i = 0; i < count; i++) {
+        if (sites[i].caller != NULL) {
+            kprintf("%p  ", sites[i].caller);
+        } else {
+            vga_writestring("(other)     ");
+        }
+        kprintf("%10u  %11u  %12u\n", sites[i].live_bytes, sites[i].live_count, sites[i].total_count);
+    }
+#else
+    (void)argc;
+    (void)argv;
+    vga_writestring("kmtrace: allocation tracing not built in (make KMALLOC_TRACE=1)\n");
+#endif
+}
+
+void cmd_slabinfo(int argc, char** argv) {
+    vga_writestring("Cache            Size  Slab   Objs/Slab  Slabs  In use/Total\n");
+    
+    for (size_t i = 0; i < slab_cache_count(); i++) {
+        slab_stats_t stats;
+        slab_cache_get_stats(slab_cache_get(i), &stats);
+        
+        kprintf("%-16s %4u  %5u  %9u  %5u  %u/%u\n", stats.name, stats.stride, stats.slab_size,
+                stats.objects_per_slab, stats.slabs, stats.objects_inuse, stats.objects_total);
+    }
 }
 
 void cmd_uname(int argc, char** argv) {
@@ -497,11 +576,23 @@ void cmd_date(int argc, char** argv) {
 }
 
 void cmd_uptime(int argc, char** argv) {
-    char buffer[32];
-    vga_writestring("System uptime: ");
-    utoa(uptime_ticks / 100, buffer, 10);  // Approximate seconds
-    vga_writestring(buffer);
-    vga_writestring(" seconds (approx)\n");
+    kprintf("System uptime: %u seconds (approx)\n", uptime_ticks / 100);
+}
+
+void cmd_dmesg(int argc, char** argv) {
+    char* text = (char*)arena_alloc(&command_arena, KLOG_SIZE);
+    if (text == NULL) {
+        vga_writestring("dmesg: out of memory\n");
+        return;
+    }
+    
+    size_t len = klog_read(text, KLOG_SIZE);
+    if (len == 0) {
+        vga_writestring("(log empty)\n");
+        return;
+    }
+    vga_write(text, len);
+    if (text[len - 1] != '\n') vga_putchar('\n');
 }
 
 void cmd_reboot(int argc, char** argv) {
@@ -509,7 +600,7 @@ void cmd_reboot(int argc, char** argv) {
     if (fs_has_disk()) {
         vga_writestring("Saving filesystem...\n");
         if (fs_save()) {
-            vga_writestring("Filesystem saved.\n");
+            kprintf("Filesystem saved (%u sectors written).\n", fs_last_save_sectors());
         } else {
             vga_writestring("Warning: Failed to save filesystem.\n");
         }
@@ -534,7 +625,7 @@ void cmd_shutdown(int argc, char** argv) {
     // Save filesystem before shutdown
     vga_writestring("Saving filesystem...\n");
     if (fs_save()) {
-        vga_writestring("Filesystem saved.\n");
+        kprintf("Filesystem saved (%u sectors written).\n", fs_last_save_sectors());
     }
     
     vga_writestring("System halted. You can power off now.\n");
@@ -560,6 +651,7 @@ void cmd_sync(int argc, char** argv) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
         vga_writestring("Filesystem saved to disk successfully!\n");
         vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        kprintf("%u sectors written\n", fs_last_save_sectors());
     } else {
         vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
         vga_writestring("Error: Failed to save filesystem to disk.\n");
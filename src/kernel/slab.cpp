@@ -0,0 +1,281 @@
+/*
+ * KaiOS - Slab Allocator Implementation
+ * Object caches for fixed-size kernel objects
+ *
+ * Each cache takes slabs from the page-frame allocator (buddy blocks are
+ * naturally aligned to their size) and hands out equally sized, aligned
+ * objects from them. A fresh slab is consumed with
+ * a bump pointer; freed objects are tracked in a per-slab free bitmap and
+ * reused before the slab is considered for release.
+ */
+
+#include "include/kernel/slab.h"
+#include "include/kernel/memory.h"
+#include "include/kernel/pmm.h"
+#include "include/kernel/string.h"
+
+// Registered caches
+static slab_cache_t caches[SLAB_MAX_CACHES];
+static size_t cache_count = 0;
+
+static inline size_t align_up(size_t x, size_t align) {
+    return (x + (align - 1)) & ~(align - 1);
+}
+
+static inline uint32_t* slab_map(slab_t* slab) {
+    return (uint32_t*)(slab + 1);
+}
+
+// Bytes before the first object for a slab holding capacity objects
+static size_t slab_header_size(size_t capacity, size_t align) {
+    size_t map_words = (capacity + 31) / 32;
+    return align_up(sizeof(slab_t) + map_words * sizeof(uint32_t), align);
+}
+
+static size_t slab_capacity(size_t slab_size, size_t stride, size_t align) {
+    size_t capacity = (slab_size - sizeof(slab_t)) / stride;
+    while (capacity > 0 && slab_header_size(capacity, align) + capacity * stride > slab_size) {
+        capacity--;
+    }
+    return capacity;
+}
+
+// ============================================================================
+// Slab lists
+// ============================================================================
+
+static void list_remove(slab_t** list, slab_t* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void list_push(slab_t** list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+// Return a slab to its pristine bump-allocation state
+static void slab_reset(slab_cache_t* cache, slab_t* slab) {
+    slab->inuse = 0;
+    slab->bump = 0;
+    memset(slab_map(slab), 0, cache->map_words * sizeof(uint32_t));
+}
+
+static slab_t* slab_create(slab_cache_t* cache) {
+    uint32_t order = pmm_order_for_size(cache->slab_size);
+    slab_t* slab = (slab_t*)pmm_alloc_pages(order);
+    if (slab == NULL && memory_reclaim(cache->slab_size) > 0) {
+        slab = (slab_t*)pmm_alloc_pages(order);
+    }
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->objects = (uint8_t*)slab + slab_header_size(cache->capacity, cache->align);
+    slab_reset(cache, slab);
+
+    cache->slab_count++;
+    return slab;
+}
+
+static void slab_destroy(slab_cache_t* cache, slab_t* slab) {
+    cache->slab_count--;
+    pmm_free_pages((uintptr_t)slab, pmm_order_for_size(cache->slab_size));
+}
+
+// Memory-pressure shrinker: give the spare empty slabs back to the PMM
+static size_t slab_shrink(size_t bytes) {
+    size_t released = 0;
+    for (size_t i = 0; i < cache_count && released < bytes; i++) {
+        slab_t* slab = caches[i].empty;
+        if (slab != NULL) {
+            list_remove(&caches[i].empty, slab);
+            slab_destroy(&caches[i], slab);
+            released += caches[i].slab_size;
+        }
+    }
+    return released;
+}
+
+// ============================================================================
+// Cache management
+// ============================================================================
+
+slab_cache_t* slab_cache_create(const char* name, size_t size, size_t align) {
+    if (cache_count >= SLAB_MAX_CACHES || size == 0) {
+        return NULL;
+    }
+
+    if (align == 0) {
+        align = SLAB_CACHE_LINE;
+    }
+    if ((align & (align - 1)) != 0) {
+        return NULL;  // Alignment must be a power of two
+    }
+
+    size_t stride = align_up(size, align);
+
+    // Grow the slab until it holds a reasonable number of objects
+    size_t slab_size = SLAB_MIN_SIZE;
+    while (slab_size < SLAB_MAX_SIZE && slab_capacity(slab_size, stride, align) < SLAB_MIN_OBJECTS) {
+        slab_size <<= 1;
+    }
+
+    size_t capacity = slab_capacity(slab_size, stride, align);
+    if (capacity == 0) {
+        return NULL;  // Object too large for a slab
+    }
+    if (capacity > 0xFFFF) {
+        capacity = 0xFFFF;
+    }
+
+    if (cache_count == 0) {
+        memory_register_shrinker("slab", slab_shrink, SLAB_SHRINKER_PRIORITY);
+    }
+
+    slab_cache_t* cache = &caches[cache_count++];
+    memset(cache, 0, sizeof(slab_cache_t));
+    strncpy(cache->name, name, SLAB_NAME_MAX - 1);
+    cache->name[SLAB_NAME_MAX - 1] = '\0';
+    cache->object_size = size;
+    cache->stride = stride;
+    cache->align = align;
+    cache->slab_size = slab_size;
+    cache->capacity = (uint16_t)capacity;
+    cache->map_words = (uint16_t)((capacity + 31) / 32);
+
+    return cache;
+}
+
+void slab_cache_get_stats(slab_cache_t* cache, slab_stats_t* stats) {
+    if (cache == NULL || stats == NULL) {
+        return;
+    }
+
+    stats->name = cache->name;
+    stats->object_size = cache->object_size;
+    stats->stride = cache->stride;
+    stats->slab_size = cache->slab_size;
+    stats->objects_per_slab = cache->capacity;
+    stats->slabs = cache->slab_count;
+    stats->objects_inuse = cache->objects_inuse;
+    stats->objects_total = cache->slab_count * cache->capacity;
+    stats->alloc_count = cache->alloc_count;
+    stats->free_count = cache->free_count;
+}
+
+size_t slab_cache_count(void) {
+    return cache_count;
+}
+
+slab_cache_t* slab_cache_get(size_t index) {
+    if (index >= cache_count) {
+        return NULL;
+    }
+    return &caches[index];
+}
+
+// ============================================================================
+// Object allocation
+// ============================================================================
+
+void* slab_alloc(slab_cache_t* cache) {
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    slab_t* slab = cache->partial;
+    if (slab == NULL) {
+        // Fall back to the spare empty slab, then to a brand new one
+        slab = cache->empty;
+        if (slab != NULL) {
+            list_remove(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (slab == NULL) {
+                return NULL;  // Out of memory
+            }
+        }
+        list_push(&cache->partial, slab);
+    }
+
+    uint32_t index;
+    if (slab->bump < cache->capacity) {
+        // Untouched tail of the slab: plain bump allocation
+        index = slab->bump++;
+    } else {
+        // Reuse a freed object
+        uint32_t* map = slab_map(slab);
+        uint32_t word = 0;
+        while (map[word] == 0) {
+            word++;
+        }
+        uint32_t bit = __builtin_ctz(map[word]);
+        map[word] &= ~(1U << bit);
+        index = word * 32 + bit;
+    }
+
+    slab->inuse++;
+    if (slab->inuse == cache->capacity) {
+        list_remove(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+
+    cache->objects_inuse++;
+    cache->alloc_count++;
+
+    return slab->objects + index * cache->stride;
+}
+
+void slab_free(slab_cache_t* cache, void* obj) {
+    if (cache == NULL || obj == NULL) {
+        return;
+    }
+
+    slab_t* slab = (slab_t*)((uintptr_t)obj & ~(uintptr_t)(cache->slab_size - 1));
+    if (slab->cache != cache) {
+        return;  // Not one of ours
+    }
+
+    uint32_t index = (uint32_t)(((uint8_t*)obj - slab->objects) / cache->stride);
+    uint32_t* map = slab_map(slab);
+    if (map[index / 32] & (1U << (index % 32))) {
+        return;  // Already freed (double-free protection)
+    }
+    map[index / 32] |= 1U << (index % 32);
+
+    if (slab->inuse == cache->capacity) {
+        list_remove(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+    slab->inuse--;
+
+    cache->objects_inuse--;
+    cache->free_count++;
+
+    if (slab->inuse == 0) {
+        // Keep one spare slab around, release any others
+        list_remove(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            slab_reset(cache, slab);
+            list_push(&cache->empty, slab);
+        } else {
+            slab_destroy(cache, slab);
+        }
+    }
+}
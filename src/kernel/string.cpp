@@ -4,12 +4,49 @@
 
 #include "include/kernel/string.h"
 
+// ============================================================================
+// Word-at-a-time scanning
+//
+// strlen, strchr and strcmp test four bytes per step with the has-zero-byte
+// trick. Aligned word loads never cross a page, so reading the few bytes
+// past a terminator is always safe; the one unaligned load (strcmp's second
+// string) steps over a page end a byte at a time, then resumes by words.
+// ============================================================================
+
+#define SCAN_PAGE_SIZE  4096
+#define ONES            0x01010101U
+#define HIGHS           0x80808080U
+
+// Non-zero if any byte of x is zero
+#define HAS_ZERO(x)     (((x) - ONES) & ~(x) & HIGHS)
+
+typedef uint32_t __attribute__((may_alias)) word_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32_t;
+
+static inline bool word_crosses_page(const void* ptr) {
+    return ((uintptr_t)ptr & (SCAN_PAGE_SIZE - 1)) > SCAN_PAGE_SIZE - sizeof(uint32_t);
+}
+
 size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] != '\0') {
-        len++;
+    const char* p = str;
+
+    while ((uintptr_t)p & 3) {
+        if (*p == '\0') {
+            return p - str;
+        }
+        p++;
     }
-    return len;
+
+    const word_t* w = (const word_t*)p;
+    while (!HAS_ZERO(*w)) {
+        w++;
+    }
+
+    p = (const char*)w;
+    while (*p != '\0') {
+        p++;
+    }
+    return p - str;
 }
 
 char* strcpy(char* dest, const char* src) {
@@ -32,6 +69,37 @@ char* strncpy(char* dest, const char* src, size_t n) {
 }
 
 int strcmp(const char* s1, const char* s2) {
+    while ((uintptr_t)s1 & 3) {
+        if (*s1 != *s2 || *s1 == '\0') {
+            return *(unsigned char*)s1 - *(unsigned char*)s2;
+        }
+        s1++;
+        s2++;
+    }
+
+    // s1 is aligned; skip whole words that match and hold no terminator
+    for (;;) {
+        if (word_crosses_page(s2)) {
+            // Cross the page end in bytes, keeping s1 aligned for the next word
+            for (int i = 0; i < 4; i++) {
+                if (*s1 != *s2 || *s1 == '\0') {
+                    return *(unsigned char*)s1 - *(unsigned char*)s2;
+                }
+                s1++;
+                s2++;
+            }
+            continue;
+        }
+
+        uint32_t w1 = *(const word_t*)s1;
+        uint32_t w2 = *(const unaligned_u32_t*)s2;
+        if (w1 != w2 || HAS_ZERO(w1)) {
+            break;
+        }
+        s1 += 4;
+        s2 += 4;
+    }
+
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -57,14 +125,27 @@ char* strcat(char* dest, const char* src) {
 }
 
 char* strchr(const char* str, int c) {
-    while (*str != '\0') {
-        if (*str == (char)c) {
-            return (char*)str;
-        }
+    char ch = (char)c;
+
+    while ((uintptr_t)str & 3) {
+        if (*str == ch) return (char*)str;
+        if (*str == '\0') return NULL;
         str++;
     }
-    if (c == '\0') return (char*)str;
-    return NULL;
+
+    // Stop at the first word holding either the character or a terminator
+    uint32_t pattern = (uint8_t)ch * ONES;
+    const word_t* w = (const word_t*)str;
+    while (!HAS_ZERO(*w) && !HAS_ZERO(*w ^ pattern)) {
+        w++;
+    }
+
+    str = (const char*)w;
+    while (*str != ch) {
+        if (*str == '\0') return NULL;
+        str++;
+    }
+    return (char*)str;
 }
 
 char* strrchr(const char* str, int c) {
@@ -79,63 +160,277 @@ char* strrchr(const char* str, int c) {
     return (char*)last;
 }
 
+// Boyer-Moore-Horspool: on a mismatch, shift by how far the haystack byte
+// under the needle's last position is from that byte's last occurrence
+// in the needle (shifts are capped at 255, which only shortens the skip)
 char* strstr(const char* haystack, const char* needle) {
-    if (*needle == '\0') return (char*)haystack;
-    
-    while (*haystack != '\0') {
-        const char* h = haystack;
-        const char* n = needle;
-        
-        while (*h == *n && *n != '\0') {
-            h++;
-            n++;
+    if (needle[0] == '\0') return (char*)haystack;
+    if (needle[1] == '\0') return strchr(haystack, needle[0]);
+
+    size_t m = strlen(needle);
+    size_t n = strlen(haystack);
+    if (m > n) return NULL;
+
+    uint8_t shift[256];
+    memset(shift, m < 255 ? (int)m : 255, sizeof(shift));
+    for (size_t i = 0; i < m - 1; i++) {
+        size_t distance = m - 1 - i;
+        shift[(uint8_t)needle[i]] = distance < 255 ? (uint8_t)distance : 255;
+    }
+
+    const uint8_t* h = (const uint8_t*)haystack;
+    uint8_t last = (uint8_t)needle[m - 1];
+    for (size_t pos = 0; pos <= n - m; pos += shift[h[pos + m - 1]]) {
+        if (h[pos + m - 1] == last && memcmp(h + pos, needle, m - 1) == 0) {
+            return (char*)(h + pos);
         }
-        
-        if (*n == '\0') return (char*)haystack;
-        haystack++;
     }
     return NULL;
 }
 
-void* memset(void* ptr, int value, size_t num) {
-    unsigned char* p = (unsigned char*)ptr;
+// ============================================================================
+// Memory functions
+//
+// The baseline uses the string instructions (rep movsd/stosd), which every
+// x86 runs well. Copies and fills of MEM_SSE2_MIN bytes or more switch to
+// 64-byte SSE2 blocks once cpu_init has enabled SSE: the destination is
+// aligned to 16 bytes first, the block loop runs with aligned stores, and
+// the remainder falls back to the string instructions. From MEM_STREAM_MIN
+// bytes on, stores are non-temporal so large buffers do not flush the cache.
+// ============================================================================
+
+#define MEM_SSE2_MIN    256
+#define MEM_STREAM_MIN  (256 * 1024)
+
+static bool use_sse2 = false;
+
+void string_use_sse2(bool enabled) {
+    use_sse2 = enabled;
+}
+
+// Forward copy. Short copies use plain moves, which beat the string
+// instructions' start-up cost; longer ones align the destination (a
+// misaligned rep movsd is several times slower) and move dwords.
+static inline void rep_copy(uint8_t* d, const uint8_t* s, size_t num) {
+    if (num >= 32) {
+        while ((uintptr_t)d & 3) {
+            *d++ = *s++;
+            num--;
+        }
+
+        size_t dwords = num >> 2;
+        num &= 3;
+        __asm__ volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(dwords) : : "memory");
+    }
+
+    while (num >= 4) {
+        *(unaligned_u32_t*)d = *(const unaligned_u32_t*)s;
+        d += 4;
+        s += 4;
+        num -= 4;
+    }
     while (num--) {
-        *p++ = (unsigned char)value;
+        *d++ = *s++;
     }
-    return ptr;
 }
 
-void* memcpy(void* dest, const void* src, size_t num) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
+// Backward copy for overlapping memmove (direction flag set only here)
+static inline void rep_copy_backward(uint8_t* d, const uint8_t* s, size_t num) {
+    size_t bytes = num & 3;
+    size_t dwords = num >> 2;
+    d += num - 1;
+    s += num - 1;
+    __asm__ volatile("std\n\t"
+                     "rep movsb\n\t"
+                     "sub $3, %0\n\t"
+                     "sub $3, %1\n\t"
+                     "mov %3, %%ecx\n\t"
+                     "rep movsl\n\t"
+                     "cld"
+                     : "+D"(d), "+S"(s), "+c"(bytes)
+                     : "r"(dwords)
+                     : "memory");
+}
+
+static inline void rep_fill(uint8_t* d, uint32_t pattern, size_t num) {
+    if (num >= 32) {
+        while ((uintptr_t)d & 3) {
+            *d++ = (uint8_t)pattern;
+            num--;
+        }
+
+        size_t dwords = num >> 2;
+        num &= 3;
+        __asm__ volatile("rep stosl" : "+D"(d), "+c"(dwords) : "a"(pattern) : "memory");
+    }
+
+    while (num >= 4) {
+        *(unaligned_u32_t*)d = pattern;
+        d += 4;
+        num -= 4;
+    }
     while (num--) {
-        *d++ = *s++;
+        *d++ = (uint8_t)pattern;
     }
-    return dest;
 }
 
-void* memmove(void* dest, const void* src, size_t num) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-    
-    if (d < s) {
-        while (num--) {
-            *d++ = *s++;
+// Copy num & ~63 bytes to a 16-byte aligned destination
+__attribute__((target("sse2")))
+static void sse2_copy_blocks(uint8_t* d, const uint8_t* s, size_t num, bool stream) {
+    size_t blocks = num >> 6;
+
+    if (stream) {
+        while (blocks--) {
+            __asm__ volatile("movdqu   (%1), %%xmm0\n\t"
+                             "movdqu 16(%1), %%xmm1\n\t"
+                             "movdqu 32(%1), %%xmm2\n\t"
+                             "movdqu 48(%1), %%xmm3\n\t"
+                             "movntdq %%xmm0,   (%0)\n\t"
+                             "movntdq %%xmm1, 16(%0)\n\t"
+                             "movntdq %%xmm2, 32(%0)\n\t"
+                             "movntdq %%xmm3, 48(%0)"
+                             : : "r"(d), "r"(s)
+                             : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+            d += 64;
+            s += 64;
         }
+        __asm__ volatile("sfence" : : : "memory");
     } else {
-        d += num;
-        s += num;
-        while (num--) {
-            *--d = *--s;
+        while (blocks--) {
+            __asm__ volatile("movdqu   (%1), %%xmm0\n\t"
+                             "movdqu 16(%1), %%xmm1\n\t"
+                             "movdqu 32(%1), %%xmm2\n\t"
+                             "movdqu 48(%1), %%xmm3\n\t"
+                             "movdqa %%xmm0,   (%0)\n\t"
+                             "movdqa %%xmm1, 16(%0)\n\t"
+                             "movdqa %%xmm2, 32(%0)\n\t"
+                             "movdqa %%xmm3, 48(%0)"
+                             : : "r"(d), "r"(s)
+                             : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+            d += 64;
+            s += 64;
         }
     }
+}
+
+// Fill num & ~63 bytes at a 16-byte aligned destination. The pattern is
+// broadcast and stored in one asm block so nothing can reuse xmm0 between.
+__attribute__((target("sse2")))
+static void sse2_fill_blocks(uint8_t* d, uint32_t pattern, size_t num, bool stream) {
+    size_t blocks = num >> 6;
+    if (blocks == 0) {
+        return;
+    }
+
+    if (stream) {
+        __asm__ volatile("movd %2, %%xmm0\n\t"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n\t"
+                         "movntdq %%xmm0,   (%0)\n\t"
+                         "movntdq %%xmm0, 16(%0)\n\t"
+                         "movntdq %%xmm0, 32(%0)\n\t"
+                         "movntdq %%xmm0, 48(%0)\n\t"
+                         "add $64, %0\n\t"
+                         "dec %1\n\t"
+                         "jnz 1b\n\t"
+                         "sfence"
+                         : "+r"(d), "+r"(blocks)
+                         : "r"(pattern)
+                         : "memory", "xmm0");
+    } else {
+        __asm__ volatile("movd %2, %%xmm0\n\t"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n\t"
+                         "movdqa %%xmm0,   (%0)\n\t"
+                         "movdqa %%xmm0, 16(%0)\n\t"
+                         "movdqa %%xmm0, 32(%0)\n\t"
+                         "movdqa %%xmm0, 48(%0)\n\t"
+                         "add $64, %0\n\t"
+                         "dec %1\n\t"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(blocks)
+                         : "r"(pattern)
+                         : "memory", "xmm0");
+    }
+}
+
+static void copy_forward(uint8_t* d, const uint8_t* s, size_t num, bool stream) {
+    if (use_sse2 && num >= MEM_SSE2_MIN) {
+        size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+        rep_copy(d, s, head);
+        d += head;
+        s += head;
+        num -= head;
+
+        size_t body = num & ~(size_t)63;
+        sse2_copy_blocks(d, s, body, stream);
+        d += body;
+        s += body;
+        num -= body;
+    }
+    rep_copy(d, s, num);
+}
+
+void* memset(void* ptr, int value, size_t num) {
+    uint8_t* d = (uint8_t*)ptr;
+    uint32_t pattern = (uint8_t)value * 0x01010101U;
+
+    if (use_sse2 && num >= MEM_SSE2_MIN) {
+        size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+        rep_fill(d, pattern, head);
+        d += head;
+        num -= head;
+
+        size_t body = num & ~(size_t)63;
+        sse2_fill_blocks(d, pattern, body, num >= MEM_STREAM_MIN);
+        d += body;
+        num -= body;
+    }
+    rep_fill(d, pattern, num);
+    return ptr;
+}
+
+void* memcpy(void* dest, const void* src, size_t num) {
+    copy_forward((uint8_t*)dest, (const uint8_t*)src, num, num >= MEM_STREAM_MIN);
+    return dest;
+}
+
+void* memcpy_stream(void* dest, const void* src, size_t num) {
+    copy_forward((uint8_t*)dest, (const uint8_t*)src, num, true);
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t num) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (d == s || num == 0) {
+        return dest;
+    }
+
+    if (d + num <= s || s + num <= d) {
+        // No overlap
+        copy_forward(d, s, num, false);
+    } else if (d < s) {
+        // Forward string moves read each dword before the store can reach it
+        rep_copy(d, s, num);
+    } else {
+        rep_copy_backward(d, s, num);
+    }
     return dest;
 }
 
 int memcmp(const void* ptr1, const void* ptr2, size_t num) {
-    const unsigned char* p1 = (const unsigned char*)ptr1;
-    const unsigned char* p2 = (const unsigned char*)ptr2;
-    
+    const uint8_t* p1 = (const uint8_t*)ptr1;
+    const uint8_t* p2 = (const uint8_t*)ptr2;
+
+    // Skip equal dwords, then locate the differing byte
+    while (num >= 4 && *(const unaligned_u32_t*)p1 == *(const unaligned_u32_t*)p2) {
+        p1 += 4;
+        p2 += 4;
+        num -= 4;
+    }
+
     while (num--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
@@ -167,40 +462,15 @@ int atoi(const char* str) {
     return sign * result;
 }
 
+// Negative values get a sign in base 10; other bases print the two's
+// complement bit pattern, as utoa would
 char* itoa(int value, char* str, int base) {
-    char* ptr = str;
-    char* ptr1 = str;
-    char tmp_char;
-    int tmp_value;
-    
-    if (base < 2 || base > 36) {
-        *str = '\0';
-        return str;
-    }
-    
-    // Handle negative numbers for base 10
     if (value < 0 && base == 10) {
-        *ptr++ = '-';
-        ptr1++;
-        value = -value;
-    }
-    
-    do {
-        tmp_value = value;
-        value /= base;
-        *ptr++ = "0123456789abcdefghijklmnopqrstuvwxyz"[tmp_value - value * base];
-    } while (value);
-    
-    *ptr-- = '\0';
-    
-    // Reverse the string
-    while (ptr1 < ptr) {
-        tmp_char = *ptr;
-        *ptr-- = *ptr1;
-        *ptr1++ = tmp_char;
+        str[0] = '-';
+        utoa(0U - (uint32_t)value, str + 1, base);
+        return str;
     }
-    
-    return str;
+    return utoa((uint32_t)value, str, base);
 }
 
 char* utoa(uint32_t value, char* str, int base) {